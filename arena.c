@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/*
+ * Bump allocator over caller provided storage, set up with a static initializer.
+ * Nothing is freed individually, arena_reset releases everything at once.
+ */
+
+// Returns NULL when the arena is exhausted
+void *arena_alloc(srix_arena *arena, size_t size) {
+    size_t offset = (arena->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (offset > arena->size || size > arena->size - offset) {
+        return NULL;
+    }
+
+    arena->used = offset + size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    return arena->base + offset;
+}
+
+void arena_reset(srix_arena *arena) {
+    arena->used = 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_ARENA_H__
+#define __NFC_SRIX_ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Macros */
+#define ARENA_ALIGN 16
+#define SESSION_ARENA_SIZE (16 * 1024)
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+} srix_arena;
+
+void *arena_alloc(srix_arena *arena, size_t size);
+void arena_reset(srix_arena *arena);
+
+#endif // __NFC_SRIX_ARENA_H__
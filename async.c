@@ -0,0 +1,417 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "transport.h"
+#include "health.h"
+#include "async.h"
+
+// Wake the loop, the counter is drained by srix_async_dispatch
+static void async_signal(srix_async_loop *loop) {
+    uint64_t one = 1;
+    if (write(loop->event_fd, &one, sizeof(one)) < 0) {
+        lwarning("Cannot signal async completion.\n");
+    }
+}
+
+// Lock held
+static void async_complete(srix_async_loop *loop, srix_async_request *request, srix_async_status status) {
+    request->status = status;
+    request->state = SRIX_ASYNC_DONE;
+    request->elapsed_ms = monotonic_ms() - request->submitted_ms;
+    request->next = NULL;
+    if (loop->done_tail != NULL) {
+        loop->done_tail->next = request;
+    } else {
+        loop->done_head = request;
+    }
+    loop->done_tail = request;
+    async_signal(loop);
+}
+
+// Lock held
+static void async_unqueue(srix_async_reader *reader, srix_async_request *request) {
+    srix_async_request **link = &reader->head;
+    srix_async_request *prev = NULL;
+    while (*link != request) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    *link = request->next;
+    if (reader->tail == request) reader->tail = prev;
+}
+
+// Unblock a waiting select, lock held
+static void async_interrupt(srix_async_reader *reader, srix_async_request *request) {
+    if (request->op != SRIX_ASYNC_SELECT) return;
+    if (reader->device != NULL) {
+        nfc_abort_command(reader->device);
+    } else if (active_transport != NULL) {
+        active_transport->abort(active_transport->ctx);
+    }
+}
+
+// 1 while the tag is in the field, 0 once it left, -1 when the reader failed
+static int async_presence(srix_async_reader *reader) {
+    if (reader->device == NULL) {
+        return active_transport != NULL && active_transport->is_present(active_transport->ctx) ? 1 : 0;
+    }
+    int res = nfc_initiator_target_is_present(reader->device, &reader->target);
+    if (res == 0) return 1;
+    return res == NFC_EIO || res == NFC_ENOTSUCHDEV ? -1 : 0;
+}
+
+// Select and presence errors never pass nfc_transceive_bytes, score them here
+static void async_reader_failed(srix_async_reader *reader, double start) {
+    reader_health *health = health_for_device(reader->device);
+    if (health != NULL) health_record(health, false, monotonic_ms() - start);
+}
+
+static bool async_stopped(srix_async_loop *loop, const srix_async_request *request) {
+    pthread_mutex_lock(&loop->lock);
+    bool stopped = request->cancelled || request->timed_out;
+    pthread_mutex_unlock(&loop->lock);
+    return stopped;
+}
+
+// Blocking part, runs on the reader's worker without the lock
+static bool async_execute(srix_async_reader *reader, srix_async_request *request) {
+    double start = monotonic_ms();
+    int res;
+
+    switch (request->op) {
+        case SRIX_ASYNC_SELECT:
+            if (reader->device == NULL) {
+                return active_transport != NULL && active_transport->select(active_transport->ctx, request->bytes);
+            }
+            res = nfc_initiator_select_passive_target(reader->device, nmISO14443B2SR, NULL, 0, &reader->target);
+            if (res <= 0) {
+                if (res < 0 && res != NFC_EOPABORTED) async_reader_failed(reader, start);
+                return false;
+            }
+            memcpy(request->bytes, reader->target.nti.nsi.abtUID, 8);
+            return true;
+        case SRIX_ASYNC_UID:
+            return nfc_srix_get_uid(reader->device, request->bytes) == SR_GET_UID_RESPONSE_LEN;
+        case SRIX_ASYNC_READ:
+            return nfc_srix_read_block(reader->device, request->bytes, request->block) == SR_READ_BLOCK_RESPONSE_LEN;
+        case SRIX_ASYNC_WRITE:
+            nfc_srix_write_block(reader->device, request->block, request->bytes);
+            return true;
+        case SRIX_ASYNC_REMOVAL:
+            res = 0;
+            while (!async_stopped(reader->loop, request) && (res = async_presence(reader)) > 0) {
+                usleep(TAG_PRESENCE_POLL_US);
+            }
+            if (res < 0) {
+                async_reader_failed(reader, start);
+                return false;
+            }
+            return true;
+    }
+    return false;
+}
+
+static void *async_worker(void *arg) {
+    srix_async_reader *reader = arg;
+    srix_async_loop *loop = reader->loop;
+
+    pthread_mutex_lock(&loop->lock);
+    while (true) {
+        while (reader->head == NULL && !reader->closing) {
+            pthread_cond_wait(&reader->wake, &loop->lock);
+        }
+        if (reader->head == NULL) break;
+
+        srix_async_request *request = reader->head;
+        async_unqueue(reader, request);
+        request->state = SRIX_ASYNC_RUNNING;
+        reader->running = request;
+        pthread_mutex_unlock(&loop->lock);
+
+        bool ok = async_execute(reader, request);
+
+        pthread_mutex_lock(&loop->lock);
+        reader->running = NULL;
+        if (request->cancelled) {
+            async_complete(loop, request, SRIX_ASYNC_CANCELLED);
+        } else if (request->timed_out) {
+            async_complete(loop, request, SRIX_ASYNC_TIMEOUT);
+        } else {
+            async_complete(loop, request, ok ? SRIX_ASYNC_OK : SRIX_ASYNC_ERROR);
+        }
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return NULL;
+}
+
+bool srix_async_init(srix_async_loop *loop) {
+    memset(loop, 0, sizeof(srix_async_loop));
+    loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->event_fd < 0) {
+        lerror("Cannot create eventfd.\n");
+        return false;
+    }
+    pthread_mutex_init(&loop->lock, NULL);
+    loop->next_id = 1;
+
+    for (uint32_t i = SRIX_ASYNC_REQUESTS; i > 0; i--) {
+        loop->requests[i - 1].next = loop->free;
+        loop->free = &loop->requests[i - 1];
+    }
+    return true;
+}
+
+/*
+ * Start a worker for device, NULL drives the active transport.
+ * The device must stay open until srix_async_close.
+ */
+srix_async_reader *srix_async_add_reader(srix_async_loop *loop, nfc_device *device, void *data) {
+    if (loop->reader_count == SRIX_ASYNC_READERS) {
+        lerror("Too many async readers.\n");
+        return NULL;
+    }
+
+    srix_async_reader *reader = &loop->readers[loop->reader_count];
+    memset(reader, 0, sizeof(srix_async_reader));
+    reader->loop = loop;
+    reader->device = device;
+    reader->data = data;
+    pthread_cond_init(&reader->wake, NULL);
+
+    if (pthread_create(&reader->worker, NULL, async_worker, reader) != 0) {
+        lerror("Cannot start async reader thread.\n");
+        pthread_cond_destroy(&reader->wake);
+        return NULL;
+    }
+    loop->reader_count++;
+    return reader;
+}
+
+static uint64_t async_submit(srix_async_reader *reader, srix_async_op op, uint8_t block, const uint8_t *bytes, uint32_t timeout_ms,
+                             srix_async_callback callback, void *data) {
+    srix_async_loop *loop = reader->loop;
+
+    pthread_mutex_lock(&loop->lock);
+    srix_async_request *request = loop->free;
+    if (request == NULL || reader->closing) {
+        pthread_mutex_unlock(&loop->lock);
+        return 0;
+    }
+    loop->free = request->next;
+
+    memset(request, 0, sizeof(srix_async_request));
+    request->id = loop->next_id++;
+    request->op = op;
+    request->reader = reader;
+    request->block = block;
+    if (bytes != NULL) memcpy(request->bytes, bytes, 4);
+    request->submitted_ms = monotonic_ms();
+    request->deadline_ms = timeout_ms > 0 ? request->submitted_ms + timeout_ms : 0;
+    request->callback = callback;
+    request->data = data;
+    request->state = SRIX_ASYNC_QUEUED;
+
+    if (reader->tail != NULL) {
+        reader->tail->next = request;
+    } else {
+        reader->head = request;
+    }
+    reader->tail = request;
+    pthread_cond_signal(&reader->wake);
+
+    uint64_t id = request->id;
+    pthread_mutex_unlock(&loop->lock);
+    return id;
+}
+
+uint64_t srix_async_select(srix_async_reader *reader, uint32_t timeout_ms, srix_async_callback callback, void *data) {
+    return async_submit(reader, SRIX_ASYNC_SELECT, 0, NULL, timeout_ms, callback, data);
+}
+
+uint64_t srix_async_uid(srix_async_reader *reader, uint32_t timeout_ms, srix_async_callback callback, void *data) {
+    return async_submit(reader, SRIX_ASYNC_UID, 0, NULL, timeout_ms, callback, data);
+}
+
+uint64_t srix_async_read(srix_async_reader *reader, uint8_t block, uint32_t timeout_ms, srix_async_callback callback, void *data) {
+    return async_submit(reader, SRIX_ASYNC_READ, block, NULL, timeout_ms, callback, data);
+}
+
+uint64_t srix_async_write(srix_async_reader *reader, uint8_t block, const uint8_t *bytes, uint32_t timeout_ms, srix_async_callback callback, void *data) {
+    return async_submit(reader, SRIX_ASYNC_WRITE, block, bytes, timeout_ms, callback, data);
+}
+
+uint64_t srix_async_removal(srix_async_reader *reader, uint32_t timeout_ms, srix_async_callback callback, void *data) {
+    return async_submit(reader, SRIX_ASYNC_REMOVAL, 0, NULL, timeout_ms, callback, data);
+}
+
+// Lock held
+static void async_stop_request(srix_async_loop *loop, srix_async_request *request, srix_async_status status) {
+    if (request->state == SRIX_ASYNC_QUEUED) {
+        async_unqueue(request->reader, request);
+        async_complete(loop, request, status);
+    } else if (request->state == SRIX_ASYNC_RUNNING) {
+        // The worker completes it once the blocking call returns
+        if (status == SRIX_ASYNC_CANCELLED) {
+            request->cancelled = true;
+        } else {
+            request->timed_out = true;
+        }
+        async_interrupt(request->reader, request);
+    }
+}
+
+// False when id already completed, its callback still runs in the next dispatch
+bool srix_async_cancel(srix_async_loop *loop, uint64_t id) {
+    bool found = false;
+    pthread_mutex_lock(&loop->lock);
+    for (uint32_t i = 0; i < SRIX_ASYNC_REQUESTS; i++) {
+        srix_async_request *request = &loop->requests[i];
+        if (request->id != id || (request->state != SRIX_ASYNC_QUEUED && request->state != SRIX_ASYNC_RUNNING)) continue;
+        found = !request->cancelled && !request->timed_out;
+        if (found) async_stop_request(loop, request, SRIX_ASYNC_CANCELLED);
+        break;
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return found;
+}
+
+int srix_async_fd(const srix_async_loop *loop) {
+    return loop->event_fd;
+}
+
+// Milliseconds until the next deadline, -1 when none, for poll and epoll_wait
+int srix_async_timeout_ms(srix_async_loop *loop) {
+    double now = monotonic_ms();
+    double next = -1;
+
+    pthread_mutex_lock(&loop->lock);
+    for (uint32_t i = 0; i < SRIX_ASYNC_REQUESTS; i++) {
+        const srix_async_request *request = &loop->requests[i];
+        if (request->state != SRIX_ASYNC_QUEUED && request->state != SRIX_ASYNC_RUNNING) continue;
+
+        // Interrupted selects are interrupted again until their worker notices
+        double due = request->deadline_ms;
+        if (request->timed_out || request->cancelled) {
+            if (request->state != SRIX_ASYNC_RUNNING || request->op != SRIX_ASYNC_SELECT) continue;
+            due = now + TAG_PRESENCE_POLL_US / 1000;
+        }
+        if (due == 0) continue;
+        if (next < 0 || due < next) next = due;
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    if (next < 0) return -1;
+    return next <= now ? 0 : (int) ceil(next - now);
+}
+
+// Time out overdue requests and run the callbacks of completed ones
+uint32_t srix_async_dispatch(srix_async_loop *loop) {
+    // EAGAIN when only deadlines are due
+    uint64_t count;
+    if (read(loop->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        lwarning("Cannot read async completions.\n");
+    }
+
+    double now = monotonic_ms();
+    pthread_mutex_lock(&loop->lock);
+    for (uint32_t i = 0; i < SRIX_ASYNC_REQUESTS; i++) {
+        srix_async_request *request = &loop->requests[i];
+        if (request->timed_out || request->cancelled) {
+            // An abort sent before the worker entered select can be lost
+            if (request->state == SRIX_ASYNC_RUNNING) async_interrupt(request->reader, request);
+            continue;
+        }
+        if (request->deadline_ms == 0 || request->deadline_ms > now) continue;
+        async_stop_request(loop, request, SRIX_ASYNC_TIMEOUT);
+    }
+    srix_async_request *done = loop->done_head;
+    loop->done_head = loop->done_tail = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    // Callbacks may submit and cancel, the lock is not held
+    uint32_t dispatched = 0;
+    while (done != NULL) {
+        srix_async_request *next = done->next;
+        if (done->callback != NULL) done->callback(done, done->data);
+
+        pthread_mutex_lock(&loop->lock);
+        done->state = SRIX_ASYNC_FREE;
+        done->next = loop->free;
+        loop->free = done;
+        pthread_mutex_unlock(&loop->lock);
+
+        done = next;
+        dispatched++;
+    }
+    return dispatched;
+}
+
+// Cancel everything, stop the workers and run the remaining callbacks
+void srix_async_close(srix_async_loop *loop) {
+    pthread_mutex_lock(&loop->lock);
+    for (uint32_t i = 0; i < loop->reader_count; i++) {
+        loop->readers[i].closing = true;
+        pthread_cond_signal(&loop->readers[i].wake);
+    }
+    for (uint32_t i = 0; i < SRIX_ASYNC_REQUESTS; i++) {
+        srix_async_request *request = &loop->requests[i];
+        if (!request->cancelled) async_stop_request(loop, request, SRIX_ASYNC_CANCELLED);
+    }
+
+    // Keep interrupting until each worker is out of its blocking call
+    for (uint32_t i = 0; i < loop->reader_count; i++) {
+        while (loop->readers[i].running != NULL) {
+            async_interrupt(&loop->readers[i], loop->readers[i].running);
+            pthread_mutex_unlock(&loop->lock);
+            usleep(TAG_PRESENCE_POLL_US / 10);
+            pthread_mutex_lock(&loop->lock);
+        }
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    for (uint32_t i = 0; i < loop->reader_count; i++) {
+        pthread_join(loop->readers[i].worker, NULL);
+        pthread_cond_destroy(&loop->readers[i].wake);
+    }
+    loop->reader_count = 0;
+
+    // Callbacks see closing readers, nothing they submit is queued
+    srix_async_dispatch(loop);
+    close(loop->event_fd);
+    pthread_mutex_destroy(&loop->lock);
+}
+
+const char *srix_async_status_name(srix_async_status status) {
+    switch (status) {
+        case SRIX_ASYNC_OK: return "ok";
+        case SRIX_ASYNC_ERROR: return "error";
+        case SRIX_ASYNC_TIMEOUT: return "timeout";
+        case SRIX_ASYNC_CANCELLED: return "cancelled";
+    }
+    return "unknown";
+}
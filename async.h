@@ -0,0 +1,130 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_ASYNC_H__
+#define __NFC_SRIX_ASYNC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <nfc/nfc.h>
+#include "nfc_utils.h"
+
+/* Macros */
+#define SRIX_ASYNC_REQUESTS 256               // in flight across all readers of a loop
+#define SRIX_ASYNC_READERS MAX_DEVICE_COUNT
+
+/*
+ * Requests run on one worker thread per reader and complete on the loop.
+ * Completions are signalled on an eventfd: poll srix_async_fd() for reading,
+ * wait at most srix_async_timeout_ms() and call srix_async_dispatch(), which
+ * runs the callbacks on the calling thread and enforces the timeouts.
+ */
+
+typedef enum {
+    SRIX_ASYNC_SELECT,        // wait for a tag, UID in bytes
+    SRIX_ASYNC_UID,           // GET_UID of the selected tag
+    SRIX_ASYNC_READ,          // block in bytes
+    SRIX_ASYNC_WRITE,         // block from bytes, no read back
+    SRIX_ASYNC_REMOVAL,       // wait until the selected tag leaves the field, ERROR if the reader fails
+} srix_async_op;
+
+typedef enum {
+    SRIX_ASYNC_OK,
+    SRIX_ASYNC_ERROR,
+    SRIX_ASYNC_TIMEOUT,       // a timed out write may still have reached the tag
+    SRIX_ASYNC_CANCELLED,
+} srix_async_status;
+
+typedef enum {
+    SRIX_ASYNC_FREE,
+    SRIX_ASYNC_QUEUED,
+    SRIX_ASYNC_RUNNING,
+    SRIX_ASYNC_DONE,
+} srix_async_state;
+
+typedef struct srix_async_loop srix_async_loop;
+typedef struct srix_async_reader srix_async_reader;
+typedef struct srix_async_request srix_async_request;
+
+typedef void (*srix_async_callback)(const srix_async_request *request, void *data);
+
+struct srix_async_request {
+    uint64_t id;
+    srix_async_op op;
+    srix_async_status status;
+    srix_async_reader *reader;
+    uint8_t block;
+    uint8_t bytes[8];
+    double submitted_ms;
+    double deadline_ms;       // 0 = none
+    double elapsed_ms;        // submit to completion
+
+    srix_async_callback callback;
+    void *data;
+
+    srix_async_state state;
+    bool cancelled;
+    bool timed_out;
+    srix_async_request *next;
+};
+
+struct srix_async_reader {
+    srix_async_loop *loop;
+    nfc_device *device;       // NULL for the active transport
+    nfc_target target;        // last selected tag
+    void *data;               // caller's
+
+    pthread_t worker;
+    pthread_cond_t wake;
+    srix_async_request *head, *tail;
+    srix_async_request *running;
+    bool closing;
+};
+
+struct srix_async_loop {
+    int event_fd;
+    pthread_mutex_t lock;
+    uint64_t next_id;
+
+    srix_async_request requests[SRIX_ASYNC_REQUESTS];
+    srix_async_request *free;
+    srix_async_request *done_head, *done_tail;
+
+    srix_async_reader readers[SRIX_ASYNC_READERS];
+    uint32_t reader_count;
+};
+
+bool srix_async_init(srix_async_loop *loop);
+srix_async_reader *srix_async_add_reader(srix_async_loop *loop, nfc_device *device, void *data);
+void srix_async_close(srix_async_loop *loop);
+
+/* Submission, 0 when SRIX_ASYNC_REQUESTS are in flight, timeout_ms 0 = none */
+uint64_t srix_async_select(srix_async_reader *reader, uint32_t timeout_ms, srix_async_callback callback, void *data);
+uint64_t srix_async_uid(srix_async_reader *reader, uint32_t timeout_ms, srix_async_callback callback, void *data);
+uint64_t srix_async_read(srix_async_reader *reader, uint8_t block, uint32_t timeout_ms, srix_async_callback callback, void *data);
+uint64_t srix_async_write(srix_async_reader *reader, uint8_t block, const uint8_t *bytes, uint32_t timeout_ms, srix_async_callback callback, void *data);
+uint64_t srix_async_removal(srix_async_reader *reader, uint32_t timeout_ms, srix_async_callback callback, void *data);
+bool srix_async_cancel(srix_async_loop *loop, uint64_t id);
+
+/* Event loop integration */
+int srix_async_fd(const srix_async_loop *loop);
+int srix_async_timeout_ms(srix_async_loop *loop);
+uint32_t srix_async_dispatch(srix_async_loop *loop);
+
+const char *srix_async_status_name(srix_async_status status);
+
+#endif // __NFC_SRIX_ASYNC_H__
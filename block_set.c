@@ -0,0 +1,100 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "logging.h"
+#include "block_set.h"
+
+srix_block_set block_selection;
+bool block_selection_set = false;
+
+void set_block_selection(const srix_block_set *set) {
+    block_selection = *set;
+    block_selection_set = true;
+}
+
+void block_set_clear(srix_block_set *set) {
+    memset(set->bits, 0, sizeof(set->bits));
+}
+
+void block_set_add_range(srix_block_set *set, uint8_t first, uint8_t last) {
+    for (unsigned int i = first; i <= last; i++) {
+        set->bits[i / 8] |= 1u << (i % 8);
+    }
+}
+
+bool block_set_has(const srix_block_set *set, uint8_t block) {
+    return (set->bits[block / 8] >> (block % 8)) & 1u;
+}
+
+// Number of selected blocks below blocks
+uint32_t block_set_count(const srix_block_set *set, uint32_t blocks) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < blocks && i < 256; i++) {
+        if (block_set_has(set, i)) count++;
+    }
+    return count;
+}
+
+/*
+ * Parse a list of hexadecimal blocks and ranges, e.g. "05-06,10-1F,7F".
+ * Returns false on malformed input.
+ */
+bool block_set_parse(srix_block_set *set, const char *spec) {
+    block_set_clear(set);
+
+    const char *p = spec;
+    while (*p) {
+        char *end;
+        unsigned long first = strtoul(p, &end, 16);
+        if (end == p || first > 0xFF) return false;
+
+        unsigned long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtoul(p, &end, 16);
+            if (end == p || last > 0xFF || last < first) return false;
+            p = end;
+        }
+
+        block_set_add_range(set, first, last);
+
+        if (*p == ',') {
+            p++;
+            if (*p == '\0') return false;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Blocks selected with -b, or every block of the tag
+const srix_block_set *selected_blocks(void) {
+    static srix_block_set all;
+
+    if (block_selection_set) {
+        return &block_selection;
+    }
+    block_set_clear(&all);
+    block_set_add_range(&all, 0, eeprom_blocks_amount - 1);
+    return &all;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_BLOCK_SET_H__
+#define __NFC_SRIX_BLOCK_SET_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Block selections */
+typedef struct {
+    uint8_t bits[32];   // one bit per block address, 0x00-0xFF
+} srix_block_set;
+
+extern srix_block_set block_selection;
+extern bool block_selection_set;
+
+void set_block_selection(const srix_block_set *);
+
+bool block_set_parse(srix_block_set *set, const char *spec);
+void block_set_clear(srix_block_set *set);
+void block_set_add_range(srix_block_set *set, uint8_t first, uint8_t last);
+bool block_set_has(const srix_block_set *set, uint8_t block);
+uint32_t block_set_count(const srix_block_set *set, uint32_t blocks);
+const srix_block_set *selected_blocks(void);
+
+#endif // __NFC_SRIX_BLOCK_SET_H__
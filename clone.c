@@ -0,0 +1,171 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "tag_profile.h"
+#include "tag_view.h"
+#include "clone.h"
+
+/*
+ * Tag to tag copy on two readers.
+ * A reader thread walks the source while this thread reads the same block
+ * from the target, waits for the source copy and writes it if it differs,
+ * so the source read of block N+1 overlaps the target write of block N.
+ */
+
+typedef struct {
+    srix_tag_view *source;
+    const srix_block_set *set;
+    uint32_t blocks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+    uint32_t next;            // blocks below next are in source->bytes or failed
+    bool failed;              // source read error at next
+    bool cancelled;
+} clone_pipeline;
+
+static void *clone_source_reader(void *arg) {
+    clone_pipeline *pipeline = arg;
+
+    for (uint32_t i = 0; i < pipeline->blocks; i++) {
+        pthread_mutex_lock(&pipeline->lock);
+        bool cancelled = pipeline->cancelled;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (cancelled) break;
+
+        bool ok = !block_set_has(pipeline->set, i) || tag_view_block(pipeline->source, i) != NULL;
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (ok) {
+            pipeline->next = i + 1;
+        } else {
+            pipeline->failed = true;
+        }
+        pthread_cond_signal(&pipeline->progress);
+        pthread_mutex_unlock(&pipeline->lock);
+
+        if (!ok) break;
+    }
+    return NULL;
+}
+
+// False when the source failed before block
+static bool clone_wait_source(clone_pipeline *pipeline, uint32_t block) {
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->next <= block && !pipeline->failed) {
+        pthread_cond_wait(&pipeline->progress, &pipeline->lock);
+    }
+    bool ready = pipeline->next > block;
+    pthread_mutex_unlock(&pipeline->lock);
+    return ready;
+}
+
+/*
+ * Copy every block of set from source to target.
+ * Blocks refused by srix_block_write_allowed are skipped, written blocks are read back.
+ */
+bool clone_run(srix_tag_view *source, srix_tag_view *target, const srix_block_set *set, uint32_t blocks, clone_result *result) {
+    memset(result, 0, sizeof(clone_result));
+    double start = monotonic_ms();
+
+    clone_pipeline pipeline = {.source = source, .set = set, .blocks = blocks};
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.progress, NULL);
+
+    pthread_t source_thread;
+    if (pthread_create(&source_thread, NULL, clone_source_reader, &pipeline) != 0) {
+        lerror("Cannot start source reader thread.\n");
+        pthread_mutex_destroy(&pipeline.lock);
+        pthread_cond_destroy(&pipeline.progress);
+        return false;
+    }
+
+    bool passed = true;
+    for (uint8_t i = 0; i < blocks; i++) {
+        if (!block_set_has(set, i)) continue;
+
+        // Target read runs while the source thread fetches this block
+        const uint8_t *current = tag_view_block(target, i);
+
+        double wait_start = monotonic_ms();
+        bool source_ready = clone_wait_source(&pipeline, i);
+        result->source_wait_ms += monotonic_ms() - wait_start;
+
+        if (current == NULL || !source_ready) {
+            result->read_error = true;
+            result->block = i;
+            passed = false;
+            break;
+        }
+
+        const uint8_t *wanted = source->bytes + (i * 4);
+        if (memcmp(current, wanted, 4) == 0) {
+            result->unchanged++;
+            continue;
+        }
+
+        if (!srix_block_write_allowed(tag_profile, i, current, wanted)) {
+            lverbose("[%02X] %08X -> %08X not allowed, skipped.\n", i, eeprom_bytes_to_block(current, 0), eeprom_bytes_to_block(wanted, 0));
+            result->skipped++;
+            continue;
+        }
+
+        lverbose("[%02X] %08X -> %08X\n", i, eeprom_bytes_to_block(current, 0), eeprom_bytes_to_block(wanted, 0));
+        nfc_srix_write_block(target->reader, i, wanted);
+        tag_view_invalidate(target, i);
+
+        const uint8_t *written = tag_view_block(target, i);
+        if (written == NULL || memcmp(written, wanted, 4) != 0) {
+            result->write_error = true;
+            result->block = i;
+            passed = false;
+            break;
+        }
+        result->written++;
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.cancelled = true;
+    pthread_mutex_unlock(&pipeline.lock);
+    pthread_join(source_thread, NULL);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.progress);
+
+    result->passed = passed;
+    result->elapsed_ms = monotonic_ms() - start;
+    return passed;
+}
+
+void clone_print_result(const char *source_uid, const char *target_uid, const clone_result *result) {
+    printf("UID %s -> %s: ", source_uid, target_uid);
+    if (result->passed) {
+        printf(GREEN "cloned" RESET);
+    } else if (result->read_error) {
+        printf(RED "read error" RESET " at block %02X", result->block);
+    } else {
+        printf(RED "write failed" RESET " at block %02X", result->block);
+    }
+    printf(", %u written, %u skipped, %u unchanged in %.2f ms (%.2f ms waiting for source)\n",
+           result->written, result->skipped, result->unchanged, result->elapsed_ms, result->source_wait_ms);
+}
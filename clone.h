@@ -0,0 +1,39 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_CLONE_H__
+#define __NFC_SRIX_CLONE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tag_view.h"
+
+typedef struct {
+    bool passed;
+    bool read_error;          // source or target could not be read
+    bool write_error;         // block did not read back as written
+    uint8_t block;            // failing block
+    uint32_t written;
+    uint32_t skipped;         // OTP bits or counters that cannot go back
+    uint32_t unchanged;
+    double source_wait_ms;    // target side waiting for source blocks
+    double elapsed_ms;
+} clone_result;
+
+bool clone_run(srix_tag_view *source, srix_tag_view *target, const srix_block_set *set, uint32_t blocks, clone_result *result);
+void clone_print_result(const char *source_uid, const char *target_uid, const clone_result *result);
+
+#endif // __NFC_SRIX_CLONE_H__
@@ -21,14 +21,118 @@
 #include <stdbool.h>
 #include <nfc/nfc.h>
 #include <inttypes.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "logging.h"
 #include "nfc_utils.h"
+#include "output.h"
+#include "tag_profile.h"
+#include "tag_view.h"
+#include "dump.h"
+#include "verify.h"
+#include "fleet_index.h"
+#include "devices.h"
+#include "arena.h"
+#include "convert.h"
+#include "transport.h"
+#include "pn532.h"
+#include "journal.h"
+#include "clone.h"
+#include "spool.h"
+#include "patch.h"
+#include "emu_tag.h"
+#include "async.h"
+#include "health.h"
+#include "soak.h"
+#include "trace.h"
+
+/* Macros */
+#define STATION_READ_TIMEOUT_MS 1000
+#define STATION_READS_IN_FLIGHT 4
+#define STATION_BACKOFF_MS 500              // after a failed select, doubles per failure
+#define STATION_BACKOFF_MAX_MS 8000
+#define WATCH_READ_TIMEOUT_MS 1000
+#define WATCH_BACKOFF_MS 500                // after a failed select, doubles per failure
+#define WATCH_BACKOFF_MAX_MS 8000
 
     
-// Initialize NFC
+// Open NFC reader
 nfc_context *context = NULL;
 nfc_device *reader = NULL;
-void initialize_nfc(){
+nfc_target selected_target;
+volatile sig_atomic_t stop_requested = 0;
+
+// Reader picked with -d, first registry reader when NULL
+const char *reader_connstring = NULL;
+
+void set_reader_connstring(const char *connstring) {
+    reader_connstring = connstring;
+}
+
+// Clone target, picked with --target or the next registry reader
+nfc_device *target_reader = NULL;
+nfc_target target_tag;
+const char *target_connstring = NULL;
+
+void set_target_connstring(const char *connstring) {
+    target_connstring = connstring;
+}
+
+bool direct_connstring(const char *connstring) {
+    return connstring != NULL && strncmp(connstring, PN532_DIRECT_PREFIX, strlen(PN532_DIRECT_PREFIX)) == 0;
+}
+
+bool emulated_connstring(const char *connstring) {
+    return connstring != NULL && strncmp(connstring, EMU_TAG_PREFIX, strlen(EMU_TAG_PREFIX)) == 0;
+}
+
+// Per session memory, tag images never come from the heap
+static uint8_t session_storage[SESSION_ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+srix_arena session_arena = {session_storage, sizeof(session_storage), 0, 0};
+
+void *session_alloc(size_t size) {
+    void *ptr = arena_alloc(&session_arena, size);
+    if (ptr == NULL) {
+        lerror("Session arena exhausted. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Zeroed image of SRIX4K_EEPROM_SIZE bytes
+uint8_t *session_image(){
+    uint8_t *image = session_alloc(SRIX4K_EEPROM_SIZE);
+    memset(image, 0, SRIX4K_EEPROM_SIZE);
+    return image;
+}
+
+// Empty tag view on the open reader
+srix_tag_view *session_view(){
+    srix_tag_view *view = session_alloc(sizeof(srix_tag_view));
+    tag_view_init(view, reader);
+    return view;
+}
+
+void open_nfc_reader(){
+
+    // Start a new session
+    arena_reset(&session_arena);
+    TRACE(reader_open_start);
+
+    // Direct PN532 path or emulated tag, libnfc is not involved
+    if (direct_connstring(reader_connstring) || emulated_connstring(reader_connstring)) {
+        srix_transport *transport = direct_connstring(reader_connstring) ? pn532_open(reader_connstring) : emu_tag_open(reader_connstring);
+        if (transport == NULL) {
+            exit(1);
+        }
+        set_active_transport(transport);
+        lverbose("NFC reader: %s\n", reader_connstring);
+        TRACE(reader_open_done);
+        return;
+    }
 
     nfc_init(&context);
     if (context == NULL) {
@@ -39,14 +143,13 @@ void initialize_nfc(){
     // Display libnfc version
     lverbose("libnfc version: %s\n", nfc_version());
 
-    // Search for readers
-    lverbose("Searching for readers... ");
+    // Get readers from the registry
     nfc_connstring connstrings[MAX_DEVICE_COUNT] = {};
-    size_t num_readers = nfc_list_devices(context, connstrings, MAX_DEVICE_COUNT);
-    lverbose("found %zu.\n", num_readers);
+    size_t num_readers = device_registry_list(connstrings, MAX_DEVICE_COUNT, NULL);
+    lverbose("Readers: %zu.\n", num_readers);
 
     // Check if no readers are available
-    if (num_readers == 0) {
+    if (num_readers == 0 && reader_connstring == NULL) {
         lerror("No readers available. Exiting...\n");
         close_nfc(context, reader);
         exit(1);
@@ -61,10 +164,12 @@ void initialize_nfc(){
         }
         lverbose("[%d] %s\n", i, connstrings[i]);
     }
-    lverbose("Opening %s...\n", connstrings[0]);
+    // Healthiest reader unless one was picked, the menu reopens it per command
+    const char *connstring = reader_connstring != NULL ? reader_connstring : connstrings[health_pick(connstrings, num_readers)];
+    lverbose("Opening %s...\n", connstring);
 
-    // Open first reader
-    reader = nfc_open(context, connstrings[0]);
+    // Open chosen or first reader
+    reader = nfc_open(context, connstring);
     if (reader == NULL) {
         lerror("Unable to open NFC device. Exiting...\n");
         close_nfc(context, reader);
@@ -89,9 +194,17 @@ void initialize_nfc(){
      * https://github.com/nfc-tools/libnfc/issues/436#issuecomment-326686914
      */
     lverbose("Searching for ISO14443B targets... found %d.\n", nfc_initiator_list_passive_targets(reader, nmISO14443B, target_key, MAX_TARGET_COUNT));
+    TRACE(reader_open_done);
+
+}
+
+// Wait for a tag on a libnfc reader
+bool select_target(nfc_device *device, nfc_target *target){
+
+    nfc_target target_key[MAX_TARGET_COUNT];
 
     lverbose("Searching for ISO14443B2SR targets...");
-    int ISO14443B2SR_targets = nfc_initiator_list_passive_targets(reader, nmISO14443B2SR, target_key, MAX_TARGET_COUNT);
+    int ISO14443B2SR_targets = nfc_initiator_list_passive_targets(device, nmISO14443B2SR, target_key, MAX_TARGET_COUNT);
     lverbose(" found %d.\n", ISO14443B2SR_targets);
 
     // Check for tags
@@ -99,45 +212,100 @@ void initialize_nfc(){
         printf("Waiting for tag...\n");
 
         // Infinite select for tag
-        if (nfc_initiator_select_passive_target(reader, nmISO14443B2SR, NULL, 0, target_key) <= 0) {
-            lerror("nfc_initiator_select_passive_target => %s\n", nfc_strerror(reader));
-            close_nfc(context, reader);
-            exit(1);
+        if (nfc_initiator_select_passive_target(device, nmISO14443B2SR, NULL, 0, target_key) <= 0) {
+            lerror("nfc_initiator_select_passive_target => %s\n", nfc_strerror(device));
+            return false;
         }
     }
 
+    *target = target_key[0];
+    return true;
 }
 
-// Read EEPROM content
-void read_eeprom_content() {
+// Select next tag
+bool select_tag(){
 
-    // Initialize NFC
-    initialize_nfc();
+    TRACE(select_start);
+    bool selected;
+    if (active_transport != NULL) {
+        printf("Waiting for tag...\n");
+        memset(&selected_target, 0, sizeof(selected_target));
+        selected = active_transport->select(active_transport->ctx, selected_target.nti.nsi.abtUID);
+    } else {
+        selected = select_target(reader, &selected_target);
+    }
+    TRACE2(select_done, selected, selected_target.nti.nsi.abtUID);
+    if (!selected) {
+        return false;
+    }
 
+    // Pick tag geometry from the UID returned by the selection
+    detect_tag_profile(selected_target.nti.nsi.abtUID);
 
-    // Read EEPROM
-    uint8_t *eeprom_bytes = malloc(sizeof(uint8_t) * eeprom_size);
-    lverbose("Reading %d blocks...\n", eeprom_blocks_amount);
-    for (int i = 0; i < eeprom_blocks_amount; i++) {
-        uint8_t *current_block = eeprom_bytes + (i * 4);
-        uint8_t block_bytes_read = nfc_srix_read_block(reader, current_block, i);
+    return true;
+}
 
-        // Check for errors
-        if (block_bytes_read != 4) {
-            lerror("Error while reading block %d. Exiting...\n", i);
-            lverbose("Received %d bytes instead of 4.\n", block_bytes_read);
-            close_nfc(context, reader);
-            exit(1);
+// Wait until the selected tag leaves the field
+void wait_for_tag_removal(){
+    lverbose("Waiting for tag removal...\n");
+    if (active_transport != NULL) {
+        while (!stop_requested && active_transport->is_present(active_transport->ctx)) {
+            usleep(TAG_PRESENCE_POLL_US);
         }
+        return;
+    }
+    while (!stop_requested && nfc_initiator_target_is_present(reader, &selected_target) == 0) {
+        usleep(TAG_PRESENCE_POLL_US);
+    }
+}
+
+// Initialize NFC
+void initialize_nfc(){
+
+    open_nfc_reader();
+
+    if (!select_tag()) {
+        close_nfc(context, reader);
+        exit(1);
+    }
+
+}
+
+// List readers
+void list_devices() {
 
-        printf("[%02X] ", i);
-        printf("%02X %02X %02X %02X ", current_block[0], current_block[1], current_block[2], current_block[3]);
-        printf(DIM);
-        printf("--- %s\n", srix_get_block_type(i));
-        printf(RESET);
+    // Rescan only if hotplug events are not being watched
+    if (!device_registry_watching()) {
+        device_registry_refresh();
     }
 
+    nfc_connstring connstrings[MAX_DEVICE_COUNT] = {};
+    uint32_t generation = 0;
+    size_t num_readers = device_registry_list(connstrings, MAX_DEVICE_COUNT, &generation);
+
+    printf("Found %zu reader(s):\n", num_readers);
+    for (unsigned int i = 0; i < num_readers; i++) {
+        printf("%s [%d] %s\n", i == num_readers - 1 ? "└──" : "├──", i, connstrings[i]);
+    }
+
+}
+
+// Read EEPROM content
+void read_eeprom_content() {
+
+    // Initialize NFC
+    initialize_nfc();
+
+
+    // Read selected blocks
+    srix_tag_view *view = session_view();
+    if (!tag_view_load(view, selected_blocks(), eeprom_blocks_amount)) {
+        close_nfc(context, reader);
+        exit(1);
+    }
 
+    // Print EEPROM
+    output_eeprom(view->bytes, eeprom_blocks_amount, selected_blocks());
 
 
     // Close NFC
@@ -152,7 +320,7 @@ void read_tag_info() {
     initialize_nfc();
 
     // Read UID
-    uint8_t uid_rx_bytes[MAX_RESPONSE_LEN] = {};
+    srix_uid_frame uid_rx_bytes = {};
     uint8_t uid_bytes_read = nfc_srix_get_uid(reader, uid_rx_bytes);
 
     // Check for errors
@@ -200,6 +368,10 @@ void read_tag_info() {
     memcpy(ic_code, uid_binary + 16, 6);
     printf("├── IC code: %s [%" PRIu64 "]\n", ic_code, (uid >> 42u) & 0x7u);
 
+    // Print tag type
+    const srix_tag_profile *profile = srix_profile_from_uid(uid_rx_bytes);
+    printf("├── Tag type: %s\n", profile != NULL ? profile->name : "unknown");
+
 
     // Print 42bit unique serial number
     char unique_serial_number[43] = {};
@@ -213,7 +385,7 @@ void read_tag_info() {
 
     
     // Print System blocks
-    uint8_t system_block_bytes[4] = {};
+    srix_block_frame system_block_bytes = {};
     uint8_t system_block_bytes_read = nfc_srix_read_block(reader, system_block_bytes, 0xFF);
 
     // Check for errors
@@ -224,7 +396,7 @@ void read_tag_info() {
         exit(1);
     }
 
-    uint32_t system_block = system_block_bytes[3] << 24u | system_block_bytes[2] << 16u | system_block_bytes[1] << 8u | system_block_bytes[0];
+    uint32_t system_block = (uint32_t) system_block_bytes[3] << 24u | system_block_bytes[2] << 16u | system_block_bytes[1] << 8u | system_block_bytes[0];
 
     printf("\nSystem block: %02X %02X %02X %02X\n", system_block_bytes[3], system_block_bytes[2], system_block_bytes[1], system_block_bytes[0]);
     printf("├── CHIP_ID: %02X\n", system_block_bytes[0]);
@@ -269,7 +441,7 @@ void write_eeprom_to_file() {
     char output_path[100];
 
     printf(YELLOW "\n>>> Enter file name: " RESET);
-    scanf("%100s", output_path); 
+    scanf("%99s", output_path); 
 
     // Check if file already exists
     FILE *file = fopen(output_path, "r");
@@ -291,33 +463,29 @@ void write_eeprom_to_file() {
     }
 
 
-    // Read EEPROM
-    uint8_t *eeprom_bytes = malloc(sizeof(uint8_t) * eeprom_size);
-    lverbose("Reading %d blocks...\n", eeprom_blocks_amount);
-    for (int i = 0; i < eeprom_blocks_amount; i++) {
-        uint8_t *current_block = eeprom_bytes + (i * 4);
-        uint8_t block_bytes_read = nfc_srix_read_block(reader, current_block, i);
-
-        // Check for errors
-        if (block_bytes_read != 4) {
-            lerror("Error while reading block %d. Exiting...\n", i);
-            lverbose("Received %d bytes instead of 4.\n", block_bytes_read);
-            close_nfc(context, reader);
-            exit(1);
-        }
+    // Read EEPROM, a dump always covers the whole tag
+    srix_tag_view *view = session_view();
+    srix_block_set all_blocks;
+    block_set_clear(&all_blocks);
+    block_set_add_range(&all_blocks, 0, eeprom_blocks_amount - 1);
 
-        printf("[%02X] ", i);
-        printf("%02X %02X %02X %02X ", current_block[0], current_block[1], current_block[2], current_block[3]);
-        printf(DIM);
-        printf("--- %s\n", srix_get_block_type(i));
-        printf(RESET);
+    if (!tag_view_load(view, &all_blocks, eeprom_blocks_amount)) {
+        close_nfc(context, reader);
+        exit(1);
     }
 
+    // Print EEPROM
+    output_eeprom(view->bytes, eeprom_blocks_amount, selected_blocks());
 
-    // export dump to file
-    FILE *fp = fopen(output_path, "w");
-    fwrite(eeprom_bytes, eeprom_size, 1, fp);
-    fclose(fp);
+
+    // export dump to file, format follows the extension
+    dump_info info = {.blocks = eeprom_blocks_amount, .has_uid = true};
+    memcpy(info.uid, selected_target.nti.nsi.abtUID, sizeof(info.uid));
+    if (!dump_save_durable(output_path, view->bytes, &info, DUMP_FORMAT_AUTO)) {
+        lerror("Cannot write \"%s\". Exiting...\n", output_path);
+        close_nfc(context, reader);
+        exit(1);
+    }
 
     printf("Written dump to \"%s\".\n", output_path);
 
@@ -332,44 +500,20 @@ void read_eeprom_file() {
 
     // Start for read dump file
     char file_path[100];
-    uint8_t *eeprom_bytes = malloc(sizeof(uint8_t) * eeprom_size);
+    arena_reset(&session_arena);
+    uint8_t *eeprom_bytes = session_image();
 
     printf(YELLOW "\n>>> Enter file name: " RESET);
-    scanf("%100s", file_path); 
+    scanf("%99s", file_path); 
 
 
-    // Open file
-    lverbose("Reading \"%s\"...\n", file_path);
-    FILE *fp = fopen(file_path, "rb");
-    if (fp == NULL) {
-        lerror("Cannot open \"%s\". Exiting...\n", file_path);
+    // Load dump
+    if (!dump_load(file_path, eeprom_bytes, true)) {
         exit(1);
     }
 
-    // Check file size
-    int fd = fileno(fp);
-    struct stat file_stat;
-    if (fstat(fd, &file_stat) < 0) {
-        lerror("Error doing fstat. Exiting...\n");
-        exit(1);
-    }
-    if (file_stat.st_size < eeprom_size) {
-        lerror("File wrong size, expected %llu but read %llu. Exiting...\n", eeprom_size, file_stat.st_size);
-        exit(1);
-    }
-
-    // Read file
-    fseek(fp, 0, SEEK_SET);
-    if (fread(eeprom_bytes, eeprom_size, 1, fp) != 1) {
-        lerror("Error encountered while reading file. Exiting...\n");
-        exit(1);
-    }
-    fclose(fp);
-
-    for(int i = 0; i < eeprom_blocks_amount; i++) {
-            uint8_t *block = eeprom_bytes + (i * 4);
-            printf("[%02X] %02X %02X %02X %02X" DIM " --- %s\n" RESET, i, block[0], block[1], block[2], block[3], srix_get_block_type(i));
-    }
+    // Print EEPROM
+    output_eeprom(eeprom_bytes, eeprom_blocks_amount, selected_blocks());
 
 }
 
@@ -384,27 +528,22 @@ void modfiy_block() {
     printf(YELLOW ">>> Enter Block address [ex 0A]:" RESET); 
     
     unsigned int block_addr;
-    scanf("%x", &block_addr);
-
-    /*
-  if (!block_addr > 2) {
-       lerror("Invalid block address %d. Exiting...\n", 1);
-        exit(0);
-    } 
- 
-    */
+    if (scanf("%x", &block_addr) != 1 || (block_addr >= eeprom_blocks_amount && block_addr != tag_profile->system_block)) {
+        lerror("Invalid block address. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
 
 
     // Read target blocks
     printf("Reading Block...\n");
  
-    uint8_t block_bytes[4] = {};
-    uint8_t block_bytes_read = nfc_srix_read_block(reader, block_bytes, block_addr);
+    srix_tag_view *view = session_view();
+    const uint8_t *block_bytes = tag_view_block(view, block_addr);
 
     // Check for errors
-    if (block_bytes_read != 4) {
-        lerror("Error while reading block %d. Exiting...\n", 1);
-        lverbose("Received %d bytes instead of 4.\n", block_bytes_read);
+    if (block_bytes == NULL) {
+        lerror("Error while reading block %d. Exiting...\n", block_addr);
         close_nfc(context, reader);
         exit(1);
     }
@@ -419,12 +558,13 @@ void modfiy_block() {
 
     printf(YELLOW ">>> Enter hexadecimal value without Space or \"0x\": " RESET); 
 
+    // 00000000 is a valid value, only unparsable input is rejected
     unsigned int block_new_value;
-    scanf("%8x", &block_new_value);
-	if (!block_new_value) {
-        lerror("Invalid hexadecimal value %d. Exiting...\n", 1);
-        exit(0);
-    } 
+    if (scanf("%8x", &block_new_value) != 1) {
+        lerror("Invalid hexadecimal value. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
 
 
     // info
@@ -459,65 +599,35 @@ void write_to_tag() {
 
     // Ask for file name
     char file_path[100];
-    uint8_t *dump_bytes = malloc(sizeof(uint8_t) * eeprom_size);
+    uint8_t *dump_bytes = session_image();
 
     printf(YELLOW "\n>>> Enter file name: " RESET);
-    scanf("%100s", file_path); 
+    scanf("%99s", file_path); 
 
 
-    // Open file
-    lverbose("Reading \"%s\"...\n", file_path);
-    FILE *fp = fopen(file_path, "rb");
-    if (fp == NULL) {
-        lerror("Cannot open \"%s\". Exiting...\n", file_path);
-        exit(1);
-    }
-
-    // Check file size
-    int fd = fileno(fp);
-    struct stat file_stat;
-    if (fstat(fd, &file_stat) < 0) {
-        lerror("Error doing fstat. Exiting...\n");
-        exit(1);
-    }
-    if (file_stat.st_size < eeprom_size) {
-        lerror("File wrong size, expected %llu but read %llu. Exiting...\n", eeprom_size, file_stat.st_size);
+    // Load dump
+    if (!dump_load(file_path, dump_bytes, false)) {
+        close_nfc(context, reader);
         exit(1);
     }
 
-    // Read file
-    fseek(fp, 0, SEEK_SET);
-    if (fread(dump_bytes, eeprom_size, 1, fp) != 1) {
-        lerror("Error encountered while reading file. Exiting...\n");
+    // Read only the blocks that may be written
+    srix_tag_view *view = session_view();
+    const srix_block_set *blocks = selected_blocks();
+    if (!tag_view_load(view, blocks, eeprom_blocks_amount)) {
+        close_nfc(context, reader);
         exit(1);
     }
-    fclose(fp);
-
-    // Read EEPROM
-    uint8_t *eeprom_bytes = malloc(sizeof(uint8_t) * eeprom_size);
-    lverbose("Reading %d blocks...\n", eeprom_blocks_amount);
-    for (int i = 0; i < eeprom_blocks_amount; i++) {
-        uint8_t *current_block = eeprom_bytes + (i * 4);
-        uint8_t block_bytes_read = nfc_srix_read_block(reader, current_block, i);
-
-        // Check for errors
-        if (block_bytes_read != 4) {
-            lerror("Error while reading block %d. Exiting...\n", i);
-            lverbose("Received %d bytes instead of 4.\n", block_bytes_read);
-            close_nfc(context, reader);
-            exit(1);
-        }
-    }
+    const uint8_t *eeprom_bytes = view->bytes;
 
     // Preview write
     bool is_equal = true;
-    for (uint8_t i = 7; i < eeprom_blocks_amount; i++) {
-        uint32_t dump_block = dump_bytes[(i*4)+0] << 24u | dump_bytes[(i*4)+1] << 16u | dump_bytes[(i*4)+2] << 8u | dump_bytes[(i*4)+3];
-        uint32_t eeprom_block = eeprom_bytes[(i*4)+0] << 24u | eeprom_bytes[(i*4)+1] << 16u | eeprom_bytes[(i*4)+2] << 8u | eeprom_bytes[(i*4)+3];
+    for (uint8_t i = tag_profile->counter_last + 1; i < eeprom_blocks_amount; i++) {
+        if (!block_set_has(blocks, i)) continue;
 
-        if (dump_block != eeprom_block) {
+        if (eeprom_block_differs(dump_bytes, eeprom_bytes, i)) {
             is_equal = false;
-            printf("[%02X] %08X -> %08X\n", i, dump_block, eeprom_block);
+            printf("[%02X] %08X -> %08X\n", i, eeprom_bytes_to_block(eeprom_bytes, i), eeprom_bytes_to_block(dump_bytes, i));
         }
     }
 
@@ -547,16 +657,15 @@ void write_to_tag() {
 
 
         for (uint8_t i = 0; i < eeprom_blocks_amount; i++) {
+            if (!block_set_has(blocks, i)) continue;
+
             // Skip critical sectors
-            if (!write_otp_area) {
+            if (!write_otp_area && i <= tag_profile->counter_last) {
                 continue;
             }
 
-            uint32_t dump_block = dump_bytes[(i*4)+0] << 24u | dump_bytes[(i*4)+1] << 16u | dump_bytes[(i*4)+2] << 8u | dump_bytes[(i*4)+3];
-            uint32_t eeprom_block = eeprom_bytes[(i*4)+0] << 24u | eeprom_bytes[(i*4)+1] << 16u | eeprom_bytes[(i*4)+2] << 8u | eeprom_bytes[(i*4)+3];
-
-            if (dump_block != eeprom_block) {
-                nfc_write_block(reader, dump_block, i);
+            if (eeprom_block_differs(dump_bytes, eeprom_bytes, i)) {
+                nfc_write_block(reader, eeprom_bytes_to_block(dump_bytes, i), i);
             }
         }
     } else {
@@ -568,6 +677,1187 @@ void write_to_tag() {
 
 }
 
+// Write the blocks of image that differ from the loaded view, read them back
+bool apply_image(srix_tag_view *view, const uint8_t *image, const srix_block_set *blocks, uint32_t *written, uint32_t *skipped, uint8_t *failed_block) {
+    for (uint8_t i = 0; i < eeprom_blocks_amount; i++) {
+        if (!block_set_has(blocks, i) || !eeprom_block_differs(image, view->bytes, i)) continue;
+
+        if (!srix_block_write_allowed(tag_profile, i, view->bytes + (i * 4), image + (i * 4))) {
+            lverbose("[%02X] %08X -> %08X not allowed, skipped.\n", i, eeprom_bytes_to_block(view->bytes, i), eeprom_bytes_to_block(image, i));
+            (*skipped)++;
+            continue;
+        }
+
+        lverbose("[%02X] %08X -> %08X\n", i, eeprom_bytes_to_block(view->bytes, i), eeprom_bytes_to_block(image, i));
+        nfc_srix_write_block(view->reader, i, image + (i * 4));
+        tag_view_invalidate(view, i);
+
+        const uint8_t *current_block = tag_view_block(view, i);
+        if (current_block == NULL || memcmp(current_block, image + (i * 4), 4) != 0) {
+            *failed_block = i;
+            return false;
+        }
+        (*written)++;
+    }
+    return true;
+}
+
+// Apply a patch script to the tag in one session
+bool patch_tag(const char *script_path) {
+
+    // Parse before touching the tag, the session starts with the reader
+    static patch_script script_storage;
+    patch_script *script = &script_storage;
+    if (!patch_load(script_path, script)) {
+        exit(1);
+    }
+
+    // Initialize NFC
+    initialize_nfc();
+
+    // Read each affected block once
+    srix_block_set blocks;
+    patch_blocks(script, &blocks);
+    srix_tag_view *view = session_view();
+    if (!tag_view_load(view, &blocks, eeprom_blocks_amount)) {
+        close_nfc(context, reader);
+        exit(1);
+    }
+
+    // Compute every result in memory
+    uint8_t *patched = session_image();
+    memcpy(patched, view->bytes, SRIX4K_EEPROM_SIZE);
+    char error[PATCH_ERROR_LEN];
+    if (!patch_apply(script, tag_profile, patched, error)) {
+        lerror("Cannot apply \"%s\": %s.\n", script_path, error);
+        close_nfc(context, reader);
+        exit(1);
+    }
+
+    // Preview, nothing is written if one block cannot take its new value
+    uint32_t changed = 0;
+    bool allowed = true;
+    for (uint8_t i = 0; i < eeprom_blocks_amount; i++) {
+        if (!block_set_has(&blocks, i) || !eeprom_block_differs(patched, view->bytes, i)) continue;
+
+        bool block_allowed = srix_block_write_allowed(tag_profile, i, view->bytes + (i * 4), patched + (i * 4));
+        printf("[%02X] %08X -> %08X" DIM " --- %s" RESET "%s\n", i, eeprom_bytes_to_block(view->bytes, i), eeprom_bytes_to_block(patched, i),
+               srix_get_block_type(i), block_allowed ? "" : RED " not allowed" RESET);
+        allowed = allowed && block_allowed;
+        changed++;
+    }
+
+    if (!allowed) {
+        lerror("OTP bits cannot be set again and counters cannot count up. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
+    if (changed == 0) {
+        printf("The patch does not change this NFC tag.\n");
+        close_nfc(context, reader);
+        return true;
+    }
+
+    // Ask for confirmation
+    if (!skip_confirmation) {
+        printf(YELLOW ">>> This action is irreversible. Are you sure? [Y/N]: " RESET);
+        char c = 'n';
+        scanf(" %c", &c);
+        if (c != 'Y' && c != 'y') {
+            printf("Exiting...\n");
+            exit(0);
+        }
+    }
+
+    // Write changed blocks and read them back
+    uint32_t written = 0, skipped = 0;
+    uint8_t failed_block;
+    bool ok = apply_image(view, patched, &blocks, &written, &skipped, &failed_block);
+    if (ok) {
+        printf("Patched %u blocks with %u operations.\n", written, script->count);
+    } else {
+        lerror("Write failed at block %02X.\n", failed_block);
+    }
+
+    // Close NFC
+    close_nfc(context, reader);
+
+    return ok;
+}
+
+void patch_tag_prompt() {
+
+    // Ask for file name
+    char script_path[100];
+    printf(YELLOW "\n>>> Enter patch script: " RESET);
+    scanf("%99s", script_path);
+
+    patch_tag(script_path);
+}
+
+// Verify tag against a dump
+bool verify_tag(const char *file_path) {
+
+    // Initialize NFC
+    initialize_nfc();
+
+    // Load expected dump
+    uint8_t *expected_bytes = session_image();
+    if (!dump_load(file_path, expected_bytes, false)) {
+        close_nfc(context, reader);
+        exit(1);
+    }
+
+    // Plan and run verification
+    uint8_t plan[SRIX4K_EEPROM_BLOCKS];
+    uint32_t planned = verify_plan(expected_bytes, selected_blocks(), eeprom_blocks_amount, plan);
+
+    srix_tag_view *view = session_view();
+    verify_result result;
+    bool passed = verify_run(view, expected_bytes, plan, planned, &result);
+
+    char uid[17];
+    srix_uid_to_string(selected_target.nti.nsi.abtUID, uid);
+    verify_print_result(uid, block_set_count(selected_blocks(), eeprom_blocks_amount), &result);
+
+    // Close NFC
+    close_nfc(context, reader);
+
+    return passed;
+}
+
+void verify_tag_prompt() {
+
+    // Ask for file name
+    char file_path[100];
+    printf(YELLOW "\n>>> Enter file name: " RESET);
+    scanf("%99s", file_path);
+
+    verify_tag(file_path);
+}
+
+static int compare_latency(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Time READ_BLOCK round trips on the presented tag
+bool bench_reader(uint32_t rounds) {
+
+    // Initialize NFC
+    initialize_nfc();
+
+    // Rounds are unbounded, keep them out of the session arena
+    double *latency = malloc(rounds * sizeof(double));
+    if (latency == NULL) {
+        lerror("Out of memory. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
+    uint32_t failed = 0;
+    double total = 0;
+
+    for (uint32_t i = 0; i < rounds; i++) {
+        srix_block_frame block;
+        double start = monotonic_ms();
+        if (nfc_srix_read_block(reader, block, i % eeprom_blocks_amount) != SR_READ_BLOCK_RESPONSE_LEN) {
+            failed++;
+        }
+        latency[i] = monotonic_ms() - start;
+        total += latency[i];
+    }
+
+    qsort(latency, rounds, sizeof(double), compare_latency);
+    printf("%s: %u reads, %u failed, mean %.3f ms, p50 %.3f ms, p99 %.3f ms\n",
+           active_transport != NULL ? active_transport->name : nfc_device_get_name(reader), rounds, failed,
+           total / rounds, latency[rounds / 2], latency[(uint32_t) (rounds * 0.99)]);
+    free(latency);
+
+    // Close NFC
+    close_nfc(context, reader);
+
+    return failed == 0;
+}
+
+// Stop continuous modes on Ctrl+C
+void request_stop(int sig) {
+    stop_requested = 1;
+    if (active_transport != NULL) active_transport->abort(active_transport->ctx);
+    if (reader != NULL) nfc_abort_command(reader);
+    if (target_reader != NULL) nfc_abort_command(target_reader);
+}
+
+// Reader of a continuous mode, the device stays valid until unfollow_reader
+typedef struct {
+    nfc_connstring connstring;
+    nfc_device *device;
+} followed_reader;
+
+// Stop continuous modes when their reader is unplugged
+void reader_set_changed(void *data, const nfc_connstring *connstrings, size_t count, uint32_t generation) {
+    const followed_reader *followed = data;
+
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(connstrings[i], followed->connstring) == 0) return;
+    }
+
+    lwarning("Reader %s was removed.\n", followed->connstring);
+    stop_requested = 1;
+    nfc_abort_command(followed->device);
+}
+
+// Keep the open device listed and stop when it is unplugged
+void follow_reader(followed_reader *followed, nfc_device *device) {
+    memset(followed, 0, sizeof(followed_reader));
+    strncpy(followed->connstring, nfc_device_get_connstring(device), sizeof(nfc_connstring) - 1);
+    followed->device = device;
+    device_registry_hold(followed->connstring);
+    device_registry_add_listener(reader_set_changed, followed);
+}
+
+void unfollow_reader(followed_reader *followed) {
+    device_registry_remove_listener(reader_set_changed, followed);
+    device_registry_release(followed->connstring);
+}
+
+// Write and read back the user blocks of the presented tag for cycles rounds
+bool soak_tag(uint32_t cycles, const char *series_path) {
+
+    // Initialize NFC
+    initialize_nfc();
+
+    // OTP bits and counters would not survive the first cycle
+    srix_block_set blocks;
+    block_set_clear(&blocks);
+    block_set_add_range(&blocks, tag_profile->counter_last + 1, eeprom_blocks_amount - 1);
+    if (block_selection_set) {
+        for (uint32_t i = 0; i < eeprom_blocks_amount; i++) {
+            if (block_set_has(&block_selection, i) && !block_set_has(&blocks, i)) {
+                lerror("Block %02X cannot be soaked, pick blocks %02X-%02X. Exiting...\n", i, tag_profile->counter_last + 1, eeprom_blocks_amount - 1);
+                close_nfc(context, reader);
+                exit(1);
+            }
+        }
+        blocks = block_selection;
+    }
+
+    // Ask for confirmation
+    if (!skip_confirmation) {
+        printf(YELLOW ">>> Every cycle overwrites %u blocks and wears the tag out. Are you sure? [Y/N]: " RESET, block_set_count(&blocks, eeprom_blocks_amount));
+        char c = 'n';
+        scanf(" %c", &c);
+        if (c != 'Y' && c != 'y') {
+            printf("Exiting...\n");
+            close_nfc(context, reader);
+            return true;
+        }
+    }
+
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+    if (cycles == 0) printf("Soaking until Ctrl+C.\n");
+
+    bool passed = soak_run(reader, selected_target.nti.nsi.abtUID, &blocks, cycles, series_path, &stop_requested);
+
+    signal(SIGINT, SIG_DFL);
+
+    // Close NFC
+    close_nfc(context, reader);
+
+    return passed;
+}
+
+void soak_tag_prompt() {
+
+    // Ask for cycles and file name
+    uint32_t cycles = 0;
+    char series_path[100];
+    printf(YELLOW "\n>>> Enter cycles (0 until Ctrl+C): " RESET);
+    if (scanf("%" SCNu32, &cycles) != 1) return;
+    printf(YELLOW ">>> Enter time series file: " RESET);
+    scanf("%99s", series_path);
+
+    soak_tag(cycles, series_path);
+}
+
+// Write the differing blocks of the indexed dump to the selected tag
+bool restore_selected_tag(fleet_index *index) {
+    char uid[17];
+    srix_uid_to_string(selected_target.nti.nsi.abtUID, uid);
+    double start = monotonic_ms();
+
+    // Each tag is its own session
+    arena_reset(&session_arena);
+
+    // Look up dump
+    const char *path = fleet_index_find(index, srix_uid_to_u64(selected_target.nti.nsi.abtUID));
+    if (path == NULL) {
+        printf("UID %s: " RED "no dump" RESET "\n", uid);
+        return false;
+    }
+
+    uint8_t *dump_bytes = session_image();
+    if (!dump_load(path, dump_bytes, false)) {
+        return false;
+    }
+
+    // Read only the blocks that may be written
+    srix_tag_view *view = session_view();
+    const srix_block_set *blocks = selected_blocks();
+    if (!tag_view_load(view, blocks, eeprom_blocks_amount)) {
+        printf("UID %s: " RED "read error" RESET "\n", uid);
+        return false;
+    }
+
+    // Write differing blocks and read them back
+    uint32_t written = 0, skipped = 0;
+    uint8_t failed_block;
+    if (!apply_image(view, dump_bytes, blocks, &written, &skipped, &failed_block)) {
+        printf("UID %s: " RED "write failed" RESET " at block %02X\n", uid, failed_block);
+        return false;
+    }
+
+    printf("UID %s: " GREEN "restored" RESET " %u blocks, %u skipped in %.2f ms from \"%s\"\n", uid, written, skipped, monotonic_ms() - start, path);
+    return true;
+}
+
+// Restore every presented tag from a dump directory
+void restore_tags(const char *dir_path) {
+
+    // Index dumps by UID
+    fleet_index index;
+    if (!fleet_index_load(&index, dir_path)) {
+        exit(1);
+    }
+
+    // Open reader once for the whole stream
+    open_nfc_reader();
+
+    // Direct serial readers are not in the libnfc registry
+    followed_reader followed;
+    if (reader != NULL) follow_reader(&followed, reader);
+    device_registry_watch();
+
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+    printf("Restoring tags from \"%s\" (%zu dumps), press Ctrl+C to stop.\n", dir_path, index.count);
+
+    uint32_t restored = 0, failed = 0;
+    while (!stop_requested && select_tag()) {
+        if (restore_selected_tag(&index)) {
+            restored++;
+        } else {
+            failed++;
+        }
+        wait_for_tag_removal();
+    }
+
+    signal(SIGINT, SIG_DFL);
+    device_registry_unwatch();
+    if (reader != NULL) unfollow_reader(&followed);
+    printf("Restored %u tags, %u failed.\n", restored, failed);
+
+    // Close NFC
+    fleet_index_free(&index);
+    close_nfc(context, reader);
+    reader = NULL;
+    context = NULL;
+}
+
+void restore_tags_prompt() {
+
+    // Ask for directory
+    char dir_path[100];
+    printf(YELLOW "\n>>> Enter dump directory: " RESET);
+    scanf("%99s", dir_path);
+
+    restore_tags(dir_path);
+}
+
+// Open a registry reader for the async commands and keep it listed, NULL on failure
+nfc_device *open_async_device(const char *connstring) {
+    nfc_device *device = nfc_open(context, connstring);
+    if (device == NULL || nfc_initiator_init(device) < 0) {
+        lwarning("Unable to open \"%s\", skipped.\n", connstring);
+        if (device != NULL) nfc_close(device);
+        return NULL;
+    }
+
+    // Same ISO14443B register setup as open_nfc_reader
+    nfc_target target_key[MAX_TARGET_COUNT];
+    nfc_initiator_list_passive_targets(device, nmISO14443B, target_key, MAX_TARGET_COUNT);
+    device_registry_hold(connstring);
+    return device;
+}
+
+// Open the -d reader, or every registry reader, for the async commands
+uint32_t open_all_readers(nfc_device **devices, nfc_connstring *names) {
+    uint32_t count = 0;
+
+    if (reader_connstring != NULL) {
+        open_nfc_reader();
+        if (reader != NULL) device_registry_hold(reader_connstring);
+        devices[count] = reader;
+        strncpy(names[count++], reader_connstring, sizeof(nfc_connstring) - 1);
+        return count;
+    }
+
+    nfc_init(&context);
+    if (context == NULL) {
+        lerror("Unable to init libnfc. Exiting...\n");
+        exit(1);
+    }
+
+    nfc_connstring connstrings[MAX_DEVICE_COUNT] = {};
+    size_t num_readers = device_registry_list(connstrings, MAX_DEVICE_COUNT, NULL);
+    for (size_t i = 0; i < num_readers && count < SRIX_ASYNC_READERS; i++) {
+        nfc_device *device = open_async_device(connstrings[i]);
+        if (device == NULL) continue;
+        devices[count] = device;
+        strncpy(names[count++], connstrings[i], sizeof(nfc_connstring) - 1);
+    }
+    if (count == 0) {
+        lerror("No readers available. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
+    return count;
+}
+
+void close_all_readers(nfc_device **devices, nfc_connstring *names, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (devices[i] != NULL) device_registry_release(names[i]);
+        if (devices[i] != NULL && devices[i] != reader) nfc_close(devices[i]);
+    }
+    close_nfc(context, reader);
+    reader = NULL;
+    context = NULL;
+}
+
+// Wake a multi-reader loop when the reader set changed, data is its eventfd
+void reader_set_wake(void *data, const nfc_connstring *connstrings, size_t count, uint32_t generation) {
+    const int *wake_fd = data;
+    uint64_t one = 1;
+    if (write(*wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        lwarning("Unable to signal a reader set change.\n");
+    }
+}
+
+bool reader_listed(const nfc_connstring *connstrings, size_t count, const char *connstring) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(connstrings[i], connstring) == 0) return true;
+    }
+    return false;
+}
+
+// Tell the operator a dump is on disk
+void station_ack(void *data, const uint8_t *uid, uint64_t seq) {
+    char uid_str[17];
+    srix_uid_to_string(uid, uid_str);
+    flockfile(stdout);
+    printf("UID %s: " GREEN "saved" RESET " (#%" PRIu64 ")\n", uid_str, seq);
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+// Per reader state of read_station
+typedef struct {
+    char name[sizeof(nfc_connstring)];
+    srix_async_reader *async;
+    reader_health *health;
+    srix_journal *journal;
+
+    uint8_t uid[8];
+    uint8_t image[SRIX4K_EEPROM_SIZE];
+    uint8_t attempts[SRIX4K_EEPROM_BLOCKS];
+    uint32_t blocks;
+    uint32_t next;            // next block to submit
+    uint32_t done;            // blocks read
+    uint32_t in_flight;
+    bool failed;
+
+    bool parked;              // quarantined or backing off, not armed
+    bool quarantined;
+    bool probing;             // this tag decides the probe, no retries
+    bool gone;                // unplugged, never armed again
+    uint64_t select_id;
+    double retry_at_ms;       // select failed, parked until then
+    double backoff_ms;
+    uint32_t dumps;
+    uint32_t failures;
+} station_reader;
+
+void station_arm(station_reader *station);
+
+// Park a reader whose select or presence check failed instead of spinning on it
+void station_backoff(station_reader *station) {
+    station->backoff_ms = station->backoff_ms == 0 ? STATION_BACKOFF_MS : station->backoff_ms * 2;
+    if (station->backoff_ms > STATION_BACKOFF_MAX_MS) station->backoff_ms = STATION_BACKOFF_MAX_MS;
+    station->retry_at_ms = monotonic_ms() + station->backoff_ms;
+    station->parked = true;
+    lwarning("Reader %s failed, retrying in %.0f ms.\n", station->name, station->backoff_ms);
+
+    if (station->probing) {
+        station->probing = false;
+        health_probe_done(station->health, false);
+    }
+}
+
+void station_removed(const srix_async_request *request, void *data) {
+    if (request->status == SRIX_ASYNC_CANCELLED) return;
+    if (request->status != SRIX_ASYNC_OK) {
+        station_backoff(data);
+        return;
+    }
+    station_arm(data);
+}
+
+// Journal the tag, settle a probe and wait for the tag to leave
+void station_finish(station_reader *station) {
+    char uid[17];
+    srix_uid_to_string(station->uid, uid);
+
+    if (station->failed) {
+        station->failures++;
+        printf("UID %s on %s: " RED "read failed" RESET "\n", uid, station->name);
+    } else if (journal_append(station->journal, station->uid, station->image, station->blocks) == 0) {
+        stop_requested = 1;
+        return;
+    } else {
+        station->dumps++;
+    }
+
+    if (station->probing) {
+        station->probing = false;
+        health_probe_done(station->health, !station->failed);
+    }
+    if (!station->gone) srix_async_removal(station->async, 0, station_removed, station);
+}
+
+void station_block_read(const srix_async_request *request, void *data) {
+    station_reader *station = data;
+    if (request->status == SRIX_ASYNC_CANCELLED) return;
+    station->in_flight--;
+
+    if (request->status == SRIX_ASYNC_OK) {
+        memcpy(station->image + request->block * 4, request->bytes, 4);
+        station->done++;
+    } else if (!station->probing && station->attempts[request->block] < TAG_VIEW_READ_RETRIES) {
+        station->attempts[request->block]++;
+        health_mark_retry(station->health);
+        station->in_flight++;
+        srix_async_read(station->async, request->block, STATION_READ_TIMEOUT_MS, station_block_read, station);
+        return;
+    } else {
+        station->failed = true;
+    }
+
+    // Keep STATION_READS_IN_FLIGHT reads queued so the worker never idles between blocks
+    while (!station->failed && station->next < station->blocks && station->in_flight < STATION_READS_IN_FLIGHT) {
+        station->in_flight++;
+        srix_async_read(station->async, station->next++, STATION_READ_TIMEOUT_MS, station_block_read, station);
+    }
+    if (station->in_flight == 0 && (station->failed || station->done == station->blocks)) {
+        station_finish(station);
+    }
+}
+
+void station_selected(const srix_async_request *request, void *data) {
+    station_reader *station = data;
+    if (request->status == SRIX_ASYNC_CANCELLED) return;
+    if (request->status != SRIX_ASYNC_OK) {
+        station_backoff(station);
+        return;
+    }
+    station->backoff_ms = 0;
+
+    memcpy(station->uid, request->bytes, 8);
+    const srix_tag_profile *profile = srix_profile_from_uid(station->uid);
+    station->blocks = (profile != NULL ? profile : tag_profile)->blocks;
+    station->next = 0;
+    station->done = 0;
+    station->in_flight = 0;
+    station->failed = false;
+    memset(station->attempts, 0, sizeof(station->attempts));
+
+    while (station->next < station->blocks && station->in_flight < STATION_READS_IN_FLIGHT) {
+        station->in_flight++;
+        srix_async_read(station->async, station->next++, STATION_READ_TIMEOUT_MS, station_block_read, station);
+    }
+}
+
+// Wait for the next tag, unless the reader is quarantined, backing off or gone
+void station_arm(station_reader *station) {
+    if (station->gone) return;
+    if (monotonic_ms() < station->retry_at_ms) {
+        station->parked = true;
+        return;
+    }
+    health_state state = health_check(station->health);
+    if (state == HEALTH_QUARANTINED) {
+        if (!station->quarantined) {
+            lwarning("%s takes no tags until it is probed, use another reader.\n", station->name);
+        }
+        station->quarantined = true;
+        station->parked = true;
+        return;
+    }
+    station->quarantined = false;
+    if (state == HEALTH_PROBE_DUE) {
+        printf("Probing %s, present a tag.\n", station->name);
+        station->probing = true;
+    }
+    station->parked = false;
+    station->select_id = srix_async_select(station->async, 0, station_selected, station);
+}
+
+// Serve a newly opened reader
+void station_start(station_reader *station, srix_async_loop *loop, nfc_device *device, const char *name, srix_journal *journal) {
+    memset(station, 0, sizeof(station_reader));
+    strncpy(station->name, name, sizeof(station->name) - 1);
+    station->journal = journal;
+    station->health = health_for_device(device);
+    station->async = srix_async_add_reader(loop, device, station);
+    if (station->async != NULL) station_arm(station);
+}
+
+// Drop readers that were unplugged and serve new ones, unless -d picked one
+void station_follow(srix_async_loop *loop, station_reader *stations, nfc_device **devices, nfc_connstring *names, uint32_t *count,
+                    srix_journal *journal) {
+    nfc_connstring connstrings[MAX_DEVICE_COUNT] = {};
+    size_t listed = device_registry_list(connstrings, MAX_DEVICE_COUNT, NULL);
+
+    for (uint32_t i = 0; i < *count; i++) {
+        if (stations[i].gone || devices[i] == NULL || reader_listed(connstrings, listed, names[i])) continue;
+        lwarning("Reader %s was removed.\n", names[i]);
+        stations[i].gone = true;
+        stations[i].parked = false;
+        srix_async_cancel(loop, stations[i].select_id);
+    }
+    if (reader_connstring != NULL) return;
+
+    for (size_t i = 0; i < listed && *count < SRIX_ASYNC_READERS; i++) {
+        bool served = false;
+        for (uint32_t j = 0; j < *count && !served; j++) {
+            served = !stations[j].gone && strcmp(names[j], connstrings[i]) == 0;
+        }
+        if (served) continue;
+
+        nfc_device *device = open_async_device(connstrings[i]);
+        if (device == NULL) continue;
+        devices[*count] = device;
+        strncpy(names[*count], connstrings[i], sizeof(nfc_connstring) - 1);
+        printf("Reading tags on %s.\n", connstrings[i]);
+        station_start(&stations[*count], loop, device, connstrings[i], journal);
+        (*count)++;
+    }
+}
+
+// Dump every presented tag on every reader into a group-committed journal
+void read_station(const char *journal_path) {
+
+    static srix_journal journal;
+    if (!journal_open(&journal, journal_path, station_ack, NULL)) {
+        exit(1);
+    }
+
+    // Open readers once for the whole stream
+    static srix_async_loop loop;
+    static station_reader stations[SRIX_ASYNC_READERS];
+    static nfc_connstring names[SRIX_ASYNC_READERS];
+    nfc_device *devices[SRIX_ASYNC_READERS] = {};
+    uint32_t count = open_all_readers(devices, names);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0 || !srix_async_init(&loop)) {
+        lerror("Cannot start the event loop. Exiting...\n");
+        exit(1);
+    }
+    struct epoll_event event = {.events = EPOLLIN};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, srix_async_fd(&loop), &event);
+
+    // Readers plugged in or removed are picked up by station_follow
+    int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+        device_registry_add_listener(reader_set_wake, &wake_fd);
+        device_registry_watch();
+    }
+
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+    printf("Reading tags on %u readers into \"%s\" (commit every %u dumps or %u ms), press Ctrl+C to stop.\n",
+           count, journal_path, journal_commit_count, journal_commit_ms);
+
+    for (uint32_t i = 0; i < count; i++) {
+        station_start(&stations[i], &loop, devices[i], names[i], &journal);
+    }
+
+    double start = monotonic_ms();
+    while (!stop_requested) {
+
+        // Parked readers are looked at again every HEALTH_PROBE_POLL_MS
+        int timeout = srix_async_timeout_ms(&loop);
+        for (uint32_t i = 0; i < count; i++) {
+            if (!stations[i].parked) continue;
+            if (timeout < 0 || timeout > HEALTH_PROBE_POLL_MS) timeout = HEALTH_PROBE_POLL_MS;
+        }
+
+        if (epoll_wait(epoll_fd, &event, 1, timeout) < 0 && errno != EINTR) {
+            lerror("epoll_wait failed.\n");
+            break;
+        }
+        srix_async_dispatch(&loop);
+
+        uint64_t changes;
+        if (wake_fd >= 0 && read(wake_fd, &changes, sizeof(changes)) == sizeof(changes)) {
+            station_follow(&loop, stations, devices, names, &count, &journal);
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if (stations[i].parked) station_arm(&stations[i]);
+        }
+    }
+    signal(SIGINT, SIG_DFL);
+    if (wake_fd >= 0) {
+        device_registry_unwatch();
+        device_registry_remove_listener(reader_set_wake, &wake_fd);
+        close(wake_fd);
+    }
+    srix_async_close(&loop);
+    close(epoll_fd);
+
+    bool saved = journal_close(&journal);
+    journal_print_stats(&journal, monotonic_ms() - start);
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        failed += stations[i].failures;
+    }
+    if (failed > 0) {
+        lwarning("%u tags could not be read.\n", failed);
+    }
+    health_print();
+
+    // Close NFC
+    close_all_readers(devices, names, count);
+
+    if (!saved) {
+        lerror("Some dumps were not saved.\n");
+        exit(1);
+    }
+}
+
+void read_station_prompt() {
+
+    // Ask for journal
+    char journal_path[100];
+    printf(YELLOW "\n>>> Enter journal file: " RESET);
+    scanf("%99s", journal_path);
+
+    read_station(journal_path);
+}
+
+// Apply the next prepared job to the selected tag
+bool encode_selected_tag(const spool_job *job) {
+    char uid[17];
+    srix_uid_to_string(selected_target.nti.nsi.abtUID, uid);
+    double start = monotonic_ms();
+
+    // Each tag is its own session
+    arena_reset(&session_arena);
+
+    srix_tag_view *view = session_view();
+    if (!tag_view_load(view, &job->plan, job->blocks)) {
+        printf("UID %s: " RED "read error" RESET "\n", uid);
+        return false;
+    }
+
+    uint32_t written = 0, skipped = 0;
+    uint8_t failed_block;
+    if (!apply_image(view, job->image, &job->plan, &written, &skipped, &failed_block)) {
+        printf("UID %s: " RED "write failed" RESET " at block %02X for \"%s\"\n", uid, failed_block, job->name);
+        return false;
+    }
+
+    printf("UID %s: " GREEN "encoded" RESET " %u blocks, %u skipped in %.2f ms from \"%s\"\n", uid, written, skipped, monotonic_ms() - start, job->name);
+    return true;
+}
+
+// Encode tags from dumps dropped into a spool directory
+void encode_spool(const char *dir_path) {
+
+    spool jobs;
+    if (!spool_open(&jobs, dir_path)) {
+        exit(1);
+    }
+
+    // Open reader once for the whole stream
+    open_nfc_reader();
+    followed_reader followed;
+    if (reader != NULL) follow_reader(&followed, reader);
+    device_registry_watch();
+
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+    printf("Encoding jobs from \"%s\", press Ctrl+C to stop.\n", dir_path);
+
+    uint32_t encoded = 0, failed = 0;
+    bool waiting = false;
+    while (!stop_requested) {
+
+        // Plans are parsed ahead, nothing is read from disk past this point
+        const spool_job *job = spool_front(&jobs, 100);
+        if (job == NULL) {
+            if (!waiting) printf("Waiting for job...\n");
+            waiting = true;
+            continue;
+        }
+        waiting = false;
+
+        if (!select_tag()) break;
+
+        if (job->profile->blocks != eeprom_blocks_amount) {
+            char uid[17];
+            srix_uid_to_string(selected_target.nti.nsi.abtUID, uid);
+            printf("UID %s: " RED "%s tag" RESET ", \"%s\" is a %s dump\n", uid, tag_profile->name, job->name, job->profile->name);
+        } else if (encode_selected_tag(job)) {
+            spool_finish(&jobs, true);
+            encoded++;
+        } else {
+            spool_finish(&jobs, false);
+            failed++;
+        }
+        wait_for_tag_removal();
+    }
+
+    signal(SIGINT, SIG_DFL);
+    device_registry_unwatch();
+    if (reader != NULL) unfollow_reader(&followed);
+    spool_close(&jobs);
+    printf("Encoded %u tags, %u failed, %u dumps rejected.\n", encoded, failed, jobs.rejected);
+
+    // Close NFC
+    close_nfc(context, reader);
+    reader = NULL;
+    context = NULL;
+}
+
+void encode_spool_prompt() {
+
+    // Ask for directory
+    char dir_path[100];
+    printf(YELLOW "\n>>> Enter spool directory: " RESET);
+    scanf("%99s", dir_path);
+
+    encode_spool(dir_path);
+}
+
+// Open the clone target next to the source reader
+void open_target_reader() {
+    if (direct_connstring(target_connstring) || emulated_connstring(target_connstring)) {
+        lerror("The clone target must be a libnfc reader. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
+
+    // The direct source path does not start libnfc
+    if (context == NULL) {
+        nfc_init(&context);
+        if (context == NULL) {
+            lerror("Unable to init libnfc. Exiting...\n");
+            close_nfc(context, reader);
+            exit(1);
+        }
+    }
+
+    const char *source = reader != NULL ? nfc_device_get_connstring(reader) : reader_connstring;
+    nfc_connstring connstrings[MAX_DEVICE_COUNT] = {};
+    size_t num_readers = device_registry_list(connstrings, MAX_DEVICE_COUNT, NULL);
+
+    // First registry reader that is not the source
+    const char *connstring = target_connstring;
+    for (size_t i = 0; connstring == NULL && i < num_readers; i++) {
+        if (strcmp(connstrings[i], source) != 0) connstring = connstrings[i];
+    }
+    if (connstring == NULL) {
+        lerror("Cloning needs a second reader. Exiting...\n");
+        close_nfc(context, reader);
+        exit(1);
+    }
+
+    lverbose("Opening target %s...\n", connstring);
+    target_reader = nfc_open(context, connstring);
+    if (target_reader == NULL || nfc_initiator_init(target_reader) < 0) {
+        lerror("Unable to open target reader \"%s\". Exiting...\n", connstring);
+        if (target_reader != NULL) nfc_close(target_reader);
+        close_nfc(context, reader);
+        exit(1);
+    }
+
+    // Same ISO14443B register setup as the source reader
+    nfc_target target_key[MAX_TARGET_COUNT];
+    nfc_initiator_list_passive_targets(target_reader, nmISO14443B, target_key, MAX_TARGET_COUNT);
+}
+
+// Copy the source tag onto every target tag presented
+void clone_tags() {
+
+    // Open both readers once for the whole stream
+    open_nfc_reader();
+    open_target_reader();
+    followed_reader followed_source, followed_target;
+    if (reader != NULL) follow_reader(&followed_source, reader);
+    follow_reader(&followed_target, target_reader);
+    device_registry_watch();
+
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+    printf("Cloning to target tags on \"%s\", press Ctrl+C to stop.\n", nfc_device_get_connstring(target_reader));
+
+    uint32_t cloned = 0, failed = 0;
+    while (!stop_requested && select_tag() && select_target(target_reader, &target_tag)) {
+        char source_uid[17], target_uid[17];
+        srix_uid_to_string(selected_target.nti.nsi.abtUID, source_uid);
+        srix_uid_to_string(target_tag.nti.nsi.abtUID, target_uid);
+
+        const srix_tag_profile *target_profile = srix_profile_from_uid(target_tag.nti.nsi.abtUID);
+        if (target_profile != NULL && target_profile->blocks != tag_profile->blocks) {
+            printf("UID %s -> %s: " RED "%s cannot hold a %s" RESET "\n", source_uid, target_uid, target_profile->name, tag_profile->name);
+            failed++;
+        } else {
+
+            // Each clone is its own session
+            arena_reset(&session_arena);
+            srix_tag_view *source_view = session_view();
+            srix_tag_view *target_view = session_alloc(sizeof(srix_tag_view));
+            tag_view_init(target_view, target_reader);
+
+            clone_result result;
+            if (clone_run(source_view, target_view, selected_blocks(), eeprom_blocks_amount, &result)) {
+                cloned++;
+            } else {
+                failed++;
+            }
+            clone_print_result(source_uid, target_uid, &result);
+        }
+
+        // Next target
+        lverbose("Waiting for target removal...\n");
+        while (!stop_requested && nfc_initiator_target_is_present(target_reader, &target_tag) == 0) {
+            usleep(TAG_PRESENCE_POLL_US);
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+    device_registry_unwatch();
+    unfollow_reader(&followed_target);
+    if (reader != NULL) unfollow_reader(&followed_source);
+    printf("Cloned %u tags, %u failed.\n", cloned, failed);
+
+    // Close NFC
+    nfc_close(target_reader);
+    target_reader = NULL;
+    close_nfc(context, reader);
+    reader = NULL;
+    context = NULL;
+}
+
+// Per reader state of watch_readers
+typedef struct {
+    char name[sizeof(nfc_connstring)];
+    srix_async_reader *async;
+    uint8_t uid[8];
+    uint8_t counter_first;
+    uint8_t counters[2][4];
+    uint32_t pending;         // counter reads in flight
+    bool failed;
+    bool gone;                // unplugged, never armed again
+    uint64_t select_id;
+    bool parked;              // select failed, armed again at retry_at_ms
+    double retry_at_ms;
+    double backoff_ms;
+    double selected_ms;
+} watch_reader;
+
+void watch_removed(const srix_async_request *request, void *data);
+
+// Park a reader whose select or presence check failed instead of spinning on it
+void watch_backoff(watch_reader *watched, const char *what, srix_async_status status) {
+    watched->backoff_ms = watched->backoff_ms == 0 ? WATCH_BACKOFF_MS : watched->backoff_ms * 2;
+    if (watched->backoff_ms > WATCH_BACKOFF_MAX_MS) watched->backoff_ms = WATCH_BACKOFF_MAX_MS;
+    watched->retry_at_ms = monotonic_ms() + watched->backoff_ms;
+    watched->parked = true;
+    lwarning("%s: %s %s, retrying in %.0f ms.\n", watched->name, what, srix_async_status_name(status), watched->backoff_ms);
+}
+
+void watch_counter_read(const srix_async_request *request, void *data) {
+    watch_reader *watched = data;
+    if (request->status == SRIX_ASYNC_CANCELLED) return;
+
+    if (request->status == SRIX_ASYNC_OK) {
+        memcpy(watched->counters[request->block - watched->counter_first], request->bytes, 4);
+    } else {
+        watched->failed = true;
+    }
+    if (--watched->pending > 0) return;
+
+    char uid[17];
+    srix_uid_to_string(watched->uid, uid);
+    if (watched->failed) {
+        printf("%s: UID %s " RED "counter read failed" RESET "\n", watched->name, uid);
+    } else {
+        printf("%s: UID %s counters %08X %08X (%.2f ms)\n", watched->name, uid, eeprom_bytes_to_block(watched->counters[0], 0),
+               eeprom_bytes_to_block(watched->counters[1], 0), monotonic_ms() - watched->selected_ms);
+    }
+    srix_async_removal(watched->async, 0, watch_removed, watched);
+}
+
+void watch_selected(const srix_async_request *request, void *data) {
+    watch_reader *watched = data;
+    if (request->status == SRIX_ASYNC_CANCELLED) return;
+    if (request->status != SRIX_ASYNC_OK) {
+        watch_backoff(watched, "select", request->status);
+        return;
+    }
+    watched->backoff_ms = 0;
+
+    // Both counters are queued at once, the worker runs them back to back
+    memcpy(watched->uid, request->bytes, 8);
+    const srix_tag_profile *profile = srix_profile_from_uid(watched->uid);
+    watched->counter_first = (profile != NULL ? profile : tag_profile)->counter_first;
+    watched->selected_ms = monotonic_ms();
+    watched->failed = false;
+    watched->pending = 2;
+    for (uint8_t i = 0; i < 2; i++) {
+        srix_async_read(watched->async, watched->counter_first + i, WATCH_READ_TIMEOUT_MS, watch_counter_read, watched);
+    }
+}
+
+void watch_removed(const srix_async_request *request, void *data) {
+    watch_reader *watched = data;
+    if (request->status == SRIX_ASYNC_CANCELLED || watched->gone) return;
+    if (request->status != SRIX_ASYNC_OK) {
+        watch_backoff(watched, "presence check", request->status);
+        return;
+    }
+    watched->select_id = srix_async_select(watched->async, 0, watch_selected, watched);
+}
+
+void watch_start(watch_reader *watched, srix_async_loop *loop, nfc_device *device, const char *name) {
+    memset(watched, 0, sizeof(watch_reader));
+    strncpy(watched->name, name, sizeof(watched->name) - 1);
+    watched->async = srix_async_add_reader(loop, device, watched);
+    if (watched->async != NULL) {
+        watched->select_id = srix_async_select(watched->async, 0, watch_selected, watched);
+    }
+}
+
+// Drop readers that were unplugged and watch new ones, unless -d picked one
+void watch_follow(srix_async_loop *loop, watch_reader *watched, nfc_device **devices, nfc_connstring *names, uint32_t *count) {
+    nfc_connstring connstrings[MAX_DEVICE_COUNT] = {};
+    size_t listed = device_registry_list(connstrings, MAX_DEVICE_COUNT, NULL);
+
+    for (uint32_t i = 0; i < *count; i++) {
+        if (watched[i].gone || devices[i] == NULL || reader_listed(connstrings, listed, names[i])) continue;
+        lwarning("Reader %s was removed.\n", names[i]);
+        watched[i].gone = true;
+        watched[i].parked = false;
+        srix_async_cancel(loop, watched[i].select_id);
+    }
+    if (reader_connstring != NULL) return;
+
+    for (size_t i = 0; i < listed && *count < SRIX_ASYNC_READERS; i++) {
+        bool served = false;
+        for (uint32_t j = 0; j < *count && !served; j++) {
+            served = !watched[j].gone && strcmp(names[j], connstrings[i]) == 0;
+        }
+        if (served) continue;
+
+        nfc_device *device = open_async_device(connstrings[i]);
+        if (device == NULL) continue;
+        devices[*count] = device;
+        strncpy(names[*count], connstrings[i], sizeof(nfc_connstring) - 1);
+        printf("Watching %s.\n", connstrings[i]);
+        watch_start(&watched[*count], loop, device, connstrings[i]);
+        (*count)++;
+    }
+}
+
+// Print the counters of every tag presented to any reader, from one event loop
+void watch_readers() {
+    static srix_async_loop loop;
+    static watch_reader watched[SRIX_ASYNC_READERS];
+    static nfc_connstring names[SRIX_ASYNC_READERS];
+    nfc_device *devices[SRIX_ASYNC_READERS] = {};
+
+    uint32_t count = open_all_readers(devices, names);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0 || !srix_async_init(&loop)) {
+        lerror("Cannot start the event loop. Exiting...\n");
+        exit(1);
+    }
+    struct epoll_event event = {.events = EPOLLIN};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, srix_async_fd(&loop), &event);
+
+    for (uint32_t i = 0; i < count; i++) {
+        watch_start(&watched[i], &loop, devices[i], names[i]);
+    }
+
+    // Readers plugged in or removed are picked up by watch_follow
+    int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+        device_registry_add_listener(reader_set_wake, &wake_fd);
+        device_registry_watch();
+    }
+
+    stop_requested = 0;
+    signal(SIGINT, request_stop);
+    printf("Watching %u readers, press Ctrl+C to stop.\n", count);
+
+    while (!stop_requested) {
+
+        // Wake up for the first parked reader that is due
+        int timeout = srix_async_timeout_ms(&loop);
+        double now = monotonic_ms();
+        for (uint32_t i = 0; i < count; i++) {
+            if (!watched[i].parked) continue;
+            int wait_ms = watched[i].retry_at_ms > now ? (int) (watched[i].retry_at_ms - now) + 1 : 0;
+            if (timeout < 0 || timeout > wait_ms) timeout = wait_ms;
+        }
+
+        if (epoll_wait(epoll_fd, &event, 1, timeout) < 0 && errno != EINTR) {
+            lerror("epoll_wait failed.\n");
+            break;
+        }
+        srix_async_dispatch(&loop);
+
+        now = monotonic_ms();
+        for (uint32_t i = 0; i < count; i++) {
+            if (!watched[i].parked || watched[i].retry_at_ms > now) continue;
+            watched[i].parked = false;
+            watched[i].select_id = srix_async_select(watched[i].async, 0, watch_selected, &watched[i]);
+        }
+
+        uint64_t changes;
+        if (wake_fd >= 0 && read(wake_fd, &changes, sizeof(changes)) == sizeof(changes)) {
+            watch_follow(&loop, watched, devices, names, &count);
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+    if (wake_fd >= 0) {
+        device_registry_unwatch();
+        device_registry_remove_listener(reader_set_wake, &wake_fd);
+        close(wake_fd);
+    }
+    srix_async_close(&loop);
+    close(epoll_fd);
+
+    // Close NFC
+    close_all_readers(devices, names, count);
+}
+
 // OTP Blocks Reset
 void otp_reset() {
    
@@ -581,7 +1871,7 @@ void otp_reset() {
         // Skip block 0x05
         if (i == 5) i++;
 
-        uint8_t block_bytes[4] = {};
+        srix_block_frame block_bytes = {};
         uint8_t block_bytes_read = nfc_srix_read_block(reader, block_bytes, i);
 
         // Check for errors
@@ -592,10 +1882,12 @@ void otp_reset() {
             exit(1);
         }
 
-        otp_blocks[i] = block_bytes[0] << 24u | block_bytes[1] << 16u | block_bytes[2] << 8u | block_bytes[3];
+        // Block 0x06 is kept in otp_blocks[5]
+        uint8_t slot = i == 6 ? 5 : i;
+        otp_blocks[slot] = (uint32_t) block_bytes[0] << 24u | block_bytes[1] << 16u | block_bytes[2] << 8u | block_bytes[3];
 
-        //printf("%08X\n", otp_blocks[i]);
-        printf("[%02X] %08X \n", i, otp_blocks[i]);
+        //printf("%08X\n", otp_blocks[slot]);
+        printf("[%02X] %08X \n", i, otp_blocks[slot]);
     }
 
     // Check if already reset
@@ -652,9 +1944,33 @@ void otp_reset() {
 
 // hellp
 void print_options(const char *executable) {
-    printf("Usage: %s [-v] [-y] [-t x4k|512]\n", executable);
+    printf("Usage: %s [-v] [-y] [-d connstring] [-t auto|x4k|512] [-o hex|json|csv|raw] [-b blocks] [command]\n", executable);
     printf("\nOptions:\n");
-    printf("  -v           enable verbose - print debugging data\n");
-    printf("  -y           answer YES to all questions\n");
-    printf("  -t x4k|512   select SRIX4K or SRI512 tag type [default: x4k]\n");
+    printf("  -v                   enable verbose - print debugging data\n");
+    printf("  -y                   answer YES to all questions\n");
+    printf("  -d CONNSTRING        use this reader, pn532_direct:/dev/ttyX skips libnfc\n");
+    printf("                       emulated:wear=N,latency=US,seed=S is a tag in software\n");
+    printf("  -t auto|x4k|512      select SRIX4K or SRI512 tag type [default: auto]\n");
+    printf("  -o hex|json|csv|raw  select block listing format [default: hex]\n");
+    printf("  -b, --blocks LIST    only read/write these hex blocks, e.g. 05-06,10-1F\n");
+    printf("  --verify-order ORDER written|seq|reverse or a hex block list checked first\n");
+    printf("  --verify-sample C[:N] check a random subset catching >= N bad blocks with confidence C\n");
+    printf("  --from FORMAT        convert input format, auto|raw|eml|json|hex [default: auto]\n");
+    printf("  --to FORMAT          convert output format, raw|eml|json|hex [default: by extension]\n");
+    printf("  --target CONNSTRING  clone target reader [default: first reader other than the source]\n");
+    printf("  --commit N[:MS]      station commits every N dumps or MS milliseconds [default: 32:20]\n");
+    printf("\nCommands:\n");
+    printf("  verify FILE          verify the presented tag against a dump, exit 1 on mismatch\n");
+    printf("  restore DIR          restore every presented tag from DIR/<UID>.bin until Ctrl+C\n");
+    printf("  convert SRC DST      convert a dump file or a directory of dumps using all cores\n");
+    printf("  patch SCRIPT         apply masked set, |= &= ^= and counter -= operations in one session\n");
+    printf("  encode DIR           write dumps dropped into DIR to presented tags until Ctrl+C\n");
+    printf("  clone                copy the source tag onto each target tag until Ctrl+C\n");
+    printf("  station JOURNAL      dump tags presented to any reader (or -d) into JOURNAL until Ctrl+C\n");
+    printf("  export JOURNAL DIR   write the latest dump of each tag in JOURNAL to DIR/<UID>.bin\n");
+    printf("  bench N              time N block reads on the presented tag\n");
+    printf("  watch                print the counters of tags presented to any reader until Ctrl+C\n");
+    printf("  soak N FILE          write and read back the user blocks N times (0 until Ctrl+C), exit 1 on drift\n");
+    printf("  soak-report FILE     summarize a soak time series and replay its drift detection\n");
+    printf("  diff-fleet A B [OUT] compare two dump directories or journals by UID, changed blocks to OUT\n");
 }
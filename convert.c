@@ -0,0 +1,264 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "tag_profile.h"
+#include "convert.h"
+
+/*
+ * The directory is streamed through a bounded queue of file names, so only
+ * CONVERT_QUEUE_LEN names and one image per worker are held at any time.
+ */
+
+typedef struct {
+    const char *src_dir;
+    const char *dst_dir;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    char names[CONVERT_QUEUE_LEN][NAME_MAX + 1];
+    size_t head;
+    size_t count;
+    bool done;
+
+    unsigned long converted;
+    unsigned long rejected;
+} convert_job;
+
+dump_format convert_from = DUMP_FORMAT_AUTO;
+dump_format convert_to = DUMP_FORMAT_AUTO;   // from the output extension, raw for directories
+
+void set_convert_from(dump_format format) {
+    convert_from = format;
+}
+
+void set_convert_to(dump_format format) {
+    convert_to = format;
+}
+
+static void convert_reject(const char *path, const char *reason) {
+    flockfile(stderr);
+    lwarning("Rejected \"%s\": %s.\n", path, reason);
+    funlockfile(stderr);
+}
+
+// Convert one file, malformed inputs are reported and skipped
+static bool convert_file(const char *src_path, const char *dst_path, bool exclusive) {
+    uint8_t image[SRIX4K_EEPROM_SIZE];
+    dump_info info;
+    char error[DUMP_ERROR_LEN];
+
+    if (!dump_load_file(src_path, convert_from, image, &info, error)) {
+        convert_reject(src_path, error);
+        return false;
+    }
+
+    // Only whole SRI512 or SRIX4K images are accepted
+    if (srix_profile_from_size(info.blocks * 4) == NULL) {
+        snprintf(error, sizeof(error), "%u blocks, expected %u or %u", info.blocks, SRI512_EEPROM_BLOCKS, SRIX4K_EEPROM_BLOCKS);
+        convert_reject(src_path, error);
+        return false;
+    }
+
+    // Claim the output first, a.eml and a.json must not both become a.bin
+    if (exclusive) {
+        int fd = open(dst_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            convert_reject(src_path, errno == EEXIST ? "output already exists" : "cannot write output");
+            return false;
+        }
+        close(fd);
+    }
+
+    if (!dump_save(dst_path, image, &info, convert_to)) {
+        convert_reject(src_path, "cannot write output");
+        if (exclusive) unlink(dst_path);
+        return false;
+    }
+    return true;
+}
+
+static void convert_output_path(char *out, size_t out_size, const char *dst_dir, const char *name) {
+    const char *dot = strrchr(name, '.');
+    int stem = dot != NULL && dot != name ? (int) (dot - name) : (int) strlen(name);
+    snprintf(out, out_size, "%s/%.*s%s", dst_dir, stem, name, dump_format_extension(convert_to));
+}
+
+static void *convert_worker(void *arg) {
+    convert_job *job = arg;
+    char name[NAME_MAX + 1];
+    char src_path[PATH_MAX];
+    char dst_path[PATH_MAX];
+
+    while (true) {
+        pthread_mutex_lock(&job->lock);
+        while (job->count == 0 && !job->done) {
+            pthread_cond_wait(&job->not_empty, &job->lock);
+        }
+        if (job->count == 0) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        memcpy(name, job->names[job->head], sizeof(name));
+        job->head = (job->head + 1) % CONVERT_QUEUE_LEN;
+        job->count--;
+        pthread_cond_signal(&job->not_full);
+        pthread_mutex_unlock(&job->lock);
+
+        snprintf(src_path, sizeof(src_path), "%s/%s", job->src_dir, name);
+        convert_output_path(dst_path, sizeof(dst_path), job->dst_dir, name);
+
+        bool ok = convert_file(src_path, dst_path, true);
+        __atomic_fetch_add(ok ? &job->converted : &job->rejected, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static bool convert_directory(const char *src, const char *dst, unsigned long *converted, unsigned long *rejected) {
+    DIR *dir = opendir(src);
+    if (dir == NULL) {
+        lerror("Cannot open \"%s\".\n", src);
+        return false;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int) cpus : 1;
+    pthread_t threads[workers];
+
+    convert_job *job = calloc(1, sizeof(convert_job));
+    if (job == NULL) {
+        closedir(dir);
+        return false;
+    }
+    job->src_dir = src;
+    job->dst_dir = dst;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->not_empty, NULL);
+    pthread_cond_init(&job->not_full, NULL);
+
+    int started = 0;
+    while (started < workers && pthread_create(&threads[started], NULL, convert_worker, job) == 0) {
+        started++;
+    }
+    lverbose("Converting with %d threads.\n", started);
+
+    // Produce file names
+    struct dirent *entry;
+    while (started > 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) continue;
+
+        pthread_mutex_lock(&job->lock);
+        while (job->count == CONVERT_QUEUE_LEN) {
+            pthread_cond_wait(&job->not_full, &job->lock);
+        }
+        size_t tail = (job->head + job->count) % CONVERT_QUEUE_LEN;
+        strncpy(job->names[tail], entry->d_name, NAME_MAX);
+        job->names[tail][NAME_MAX] = '\0';
+        job->count++;
+        pthread_cond_signal(&job->not_empty);
+        pthread_mutex_unlock(&job->lock);
+    }
+    closedir(dir);
+
+    pthread_mutex_lock(&job->lock);
+    job->done = true;
+    pthread_cond_broadcast(&job->not_empty);
+    pthread_mutex_unlock(&job->lock);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    *converted = job->converted;
+    *rejected = job->rejected;
+
+    pthread_cond_destroy(&job->not_full);
+    pthread_cond_destroy(&job->not_empty);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+
+    if (started == 0) {
+        lerror("Unable to start conversion threads.\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Convert a file into a file or directory, or every file of a directory into
+ * another directory. Returns false only if the batch itself could not run.
+ */
+bool convert_dumps(const char *src, const char *dst) {
+    struct stat src_stat, dst_stat;
+    if (stat(src, &src_stat) < 0) {
+        lerror("Cannot open \"%s\".\n", src);
+        return false;
+    }
+    bool dst_is_dir = stat(dst, &dst_stat) == 0 && S_ISDIR(dst_stat.st_mode);
+
+    unsigned long converted = 0, rejected = 0;
+    double start = monotonic_ms();
+
+    if (S_ISDIR(src_stat.st_mode)) {
+        if (!dst_is_dir) {
+            lerror("\"%s\" is not a directory.\n", dst);
+            return false;
+        }
+        if (src_stat.st_dev == dst_stat.st_dev && src_stat.st_ino == dst_stat.st_ino) {
+            lerror("Source and destination must be different directories.\n");
+            return false;
+        }
+        if (!convert_directory(src, dst, &converted, &rejected)) {
+            return false;
+        }
+    } else {
+        char dst_path[PATH_MAX];
+        const char *name = strrchr(src, '/') != NULL ? strrchr(src, '/') + 1 : src;
+        if (dst_is_dir) {
+            convert_output_path(dst_path, sizeof(dst_path), dst, name);
+        } else {
+            snprintf(dst_path, sizeof(dst_path), "%s", dst);
+        }
+        if (stat(dst_path, &dst_stat) == 0 && src_stat.st_dev == dst_stat.st_dev && src_stat.st_ino == dst_stat.st_ino) {
+            lerror("Source and destination must be different files.\n");
+            return false;
+        }
+        if (convert_file(src, dst_path, false)) {
+            converted++;
+        } else {
+            rejected++;
+        }
+    }
+
+    double elapsed = (monotonic_ms() - start) / 1000.0;
+    printf("Converted %lu images, %lu rejected in %.2f s (%.0f images/s).\n", converted, rejected, elapsed, elapsed > 0 ? (converted + rejected) / elapsed : 0);
+    return true;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_CONVERT_H__
+#define __NFC_SRIX_CONVERT_H__
+
+#include <stdbool.h>
+#include "dump.h"
+
+/* Macros */
+#define CONVERT_QUEUE_LEN 1024
+
+extern dump_format convert_from;
+extern dump_format convert_to;
+
+void set_convert_from(dump_format);
+void set_convert_to(dump_format);
+
+bool convert_dumps(const char *src, const char *dst);
+
+#endif // __NFC_SRIX_CONVERT_H__
@@ -0,0 +1,470 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "devices.h"
+
+/*
+ * Readers are enumerated once and cached. A monitor thread listens for kernel
+ * uevents (the netlink feed udev itself is built on) or, when that socket is
+ * not available, for /dev entries appearing and disappearing, and rescans in
+ * the background so the command path never probes serial ports.
+ *
+ * A reader this process holds open fails the rescan probe (a claimed USB
+ * interface is busy), so held readers stay listed until a remove event names
+ * their device node.
+ */
+
+typedef struct {
+    device_listener listener;
+    void *data;
+} device_listener_entry;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static nfc_connstring registry_connstrings[MAX_DEVICE_COUNT];
+static size_t registry_count = 0;
+static uint32_t registry_generation = 0;   // 0 until the first scan
+static nfc_connstring registry_held[MAX_DEVICE_COUNT];
+static uint32_t registry_held_refs[MAX_DEVICE_COUNT];
+static char registry_removed[MAX_DEVICE_COUNT][DEVICE_NODE_LEN];   // since the last rescan
+static size_t registry_removed_count = 0;
+
+// Held across listener calls, so removing a listener waits for its call to return
+static pthread_mutex_t listener_lock = PTHREAD_MUTEX_INITIALIZER;
+static device_listener_entry registry_listeners[MAX_DEVICE_LISTENERS];
+
+static pthread_t monitor_thread;
+static bool monitor_running = false;
+static int monitor_event_fd = -1;
+static int monitor_stop_fd = -1;
+static bool monitor_netlink = false;
+static struct {
+    int wd;
+    char bus[8];
+} monitor_buses[MAX_USB_BUSES];     // inotify watches on /dev/bus/usb/<bus>
+static size_t monitor_bus_count = 0;
+
+static void notify_listeners(const nfc_connstring *connstrings, size_t count, uint32_t generation) {
+    pthread_mutex_lock(&listener_lock);
+    for (int i = 0; i < MAX_DEVICE_LISTENERS; i++) {
+        if (registry_listeners[i].listener != NULL) {
+            registry_listeners[i].listener(registry_listeners[i].data, connstrings, count, generation);
+        }
+    }
+    pthread_mutex_unlock(&listener_lock);
+}
+
+// Device node of a reader, "ttyUSB0" or "bus/usb/002/005", false when the connstring names none
+static bool connstring_node(const char *connstring, char *node) {
+    const char *port = strchr(connstring, ':');
+    if (port == NULL) {
+        return false;
+    }
+    port++;
+
+    if (strncmp(port, "/dev/", 5) == 0) {
+        size_t len = strcspn(port + 5, ":");
+        if (len == 0 || len >= DEVICE_NODE_LEN) return false;
+        memcpy(node, port + 5, len);
+        node[len] = '\0';
+        return true;
+    }
+
+    unsigned int bus, device;
+    char tail;
+    if (sscanf(port, "%3u:%3u%c", &bus, &device, &tail) == 2) {
+        snprintf(node, DEVICE_NODE_LEN, "bus/usb/%03u/%03u", bus, device);
+        return true;
+    }
+    return false;
+}
+
+// Held readers missing from the scan are kept, a removed node ends the hold
+static size_t keep_held(nfc_connstring *connstrings, size_t count, char (*removed)[DEVICE_NODE_LEN], size_t removed_count) {
+    for (size_t i = 0; i < MAX_DEVICE_COUNT && count < MAX_DEVICE_COUNT; i++) {
+        if (registry_held_refs[i] == 0) continue;
+
+        bool listed = false;
+        for (size_t j = 0; j < count && !listed; j++) {
+            listed = strcmp(connstrings[j], registry_held[i]) == 0;
+        }
+        if (listed) continue;
+
+        char node[DEVICE_NODE_LEN];
+        bool gone = false;
+        if (connstring_node(registry_held[i], node)) {
+            for (size_t j = 0; j < removed_count && !gone; j++) {
+                gone = strcmp(removed[j], node) == 0;
+            }
+        }
+        if (gone) {
+            registry_held_refs[i] = 0;
+        } else {
+            memcpy(connstrings[count++], registry_held[i], sizeof(nfc_connstring));
+        }
+    }
+    return count;
+}
+
+static void record_removed(const char *node) {
+    pthread_mutex_lock(&registry_lock);
+    if (registry_removed_count < MAX_DEVICE_COUNT) {
+        strncpy(registry_removed[registry_removed_count], node, DEVICE_NODE_LEN - 1);
+        registry_removed[registry_removed_count++][DEVICE_NODE_LEN - 1] = '\0';
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+// Enumerate readers now, returns the number of readers
+size_t device_registry_refresh(void) {
+    nfc_connstring connstrings[MAX_DEVICE_COUNT] = {};
+    char removed[MAX_DEVICE_COUNT][DEVICE_NODE_LEN];
+    nfc_context *scan_context = NULL;
+
+    // Removals seen from here on are left to the next rescan
+    pthread_mutex_lock(&registry_lock);
+    size_t removed_count = registry_removed_count;
+    memcpy(removed, registry_removed, removed_count * DEVICE_NODE_LEN);
+    registry_removed_count = 0;
+    pthread_mutex_unlock(&registry_lock);
+
+    nfc_init(&scan_context);
+    if (scan_context == NULL) {
+        lerror("Unable to init libnfc.\n");
+        return 0;
+    }
+    size_t count = nfc_list_devices(scan_context, connstrings, MAX_DEVICE_COUNT);
+    nfc_exit(scan_context);
+
+    pthread_mutex_lock(&registry_lock);
+    count = keep_held(connstrings, count, removed, removed_count);
+    bool changed = registry_generation == 0 || count != registry_count
+                   || memcmp(connstrings, registry_connstrings, count * sizeof(nfc_connstring)) != 0;
+    if (changed) {
+        memcpy(registry_connstrings, connstrings, sizeof(connstrings));
+        registry_count = count;
+        registry_generation++;
+    }
+    uint32_t generation = registry_generation;
+    pthread_mutex_unlock(&registry_lock);
+
+    if (changed) {
+        lverbose("Reader set changed, %zu reader(s) [generation %u].\n", count, generation);
+        notify_listeners(connstrings, count, generation);
+    }
+    return count;
+}
+
+/*
+ * Copy the cached connstrings, enumerating only on first use.
+ * generation may be NULL.
+ */
+size_t device_registry_list(nfc_connstring *connstrings, size_t max, uint32_t *generation) {
+    pthread_mutex_lock(&registry_lock);
+    bool scanned = registry_generation != 0;
+    pthread_mutex_unlock(&registry_lock);
+
+    if (!scanned) {
+        device_registry_refresh();
+    }
+
+    pthread_mutex_lock(&registry_lock);
+    size_t count = registry_count < max ? registry_count : max;
+    memcpy(connstrings, registry_connstrings, count * sizeof(nfc_connstring));
+    if (generation != NULL) *generation = registry_generation;
+    pthread_mutex_unlock(&registry_lock);
+
+    return count;
+}
+
+bool device_registry_contains(const char *connstring) {
+    bool found = false;
+
+    pthread_mutex_lock(&registry_lock);
+    for (size_t i = 0; i < registry_count && !found; i++) {
+        found = strcmp(registry_connstrings[i], connstring) == 0;
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    return found;
+}
+
+// Keep a reader listed while this process has it open, see keep_held()
+bool device_registry_hold(const char *connstring) {
+    int slot = -1;
+
+    pthread_mutex_lock(&registry_lock);
+    for (int i = 0; i < MAX_DEVICE_COUNT; i++) {
+        if (registry_held_refs[i] > 0 && strcmp(registry_held[i], connstring) == 0) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && registry_held_refs[i] == 0) slot = i;
+    }
+    if (slot >= 0) {
+        if (registry_held_refs[slot] == 0) {
+            strncpy(registry_held[slot], connstring, sizeof(nfc_connstring) - 1);
+            registry_held[slot][sizeof(nfc_connstring) - 1] = '\0';
+        }
+        registry_held_refs[slot]++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    return slot >= 0;
+}
+
+void device_registry_release(const char *connstring) {
+    pthread_mutex_lock(&registry_lock);
+    for (int i = 0; i < MAX_DEVICE_COUNT; i++) {
+        if (registry_held_refs[i] > 0 && strcmp(registry_held[i], connstring) == 0) {
+            registry_held_refs[i]--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+bool device_registry_add_listener(device_listener listener, void *data) {
+    bool added = false;
+
+    pthread_mutex_lock(&listener_lock);
+    for (int i = 0; i < MAX_DEVICE_LISTENERS && !added; i++) {
+        if (registry_listeners[i].listener == NULL) {
+            registry_listeners[i].listener = listener;
+            registry_listeners[i].data = data;
+            added = true;
+        }
+    }
+    pthread_mutex_unlock(&listener_lock);
+
+    return added;
+}
+
+// Returns once no call of this listener is running
+void device_registry_remove_listener(device_listener listener, void *data) {
+    pthread_mutex_lock(&listener_lock);
+    for (int i = 0; i < MAX_DEVICE_LISTENERS; i++) {
+        if (registry_listeners[i].listener == listener && registry_listeners[i].data == data) {
+            registry_listeners[i].listener = NULL;
+            registry_listeners[i].data = NULL;
+        }
+    }
+    pthread_mutex_unlock(&listener_lock);
+}
+
+/*
+ * uevent: "ACTION@DEVPATH\0KEY=VALUE\0...", only USB and tty devices matter.
+ * The DEVNAME of a removed device is recorded for keep_held().
+ */
+static bool uevent_relevant(const char *buf, size_t len) {
+    bool relevant = false;
+    const char *devname = NULL;
+
+    for (size_t i = 0; i < len; i += strlen(buf + i) + 1) {
+        if (strcmp(buf + i, "SUBSYSTEM=usb") == 0 || strcmp(buf + i, "SUBSYSTEM=tty") == 0) {
+            relevant = true;
+        } else if (strncmp(buf + i, "DEVNAME=", 8) == 0) {
+            devname = buf + i + 8;
+        }
+    }
+    if (relevant && devname != NULL && strncmp(buf, "remove@", 7) == 0) {
+        record_removed(devname);
+    }
+    return relevant;
+}
+
+static bool inotify_relevant(const char *buf, size_t len) {
+    bool relevant = false;
+
+    for (size_t i = 0; i < len;) {
+        const struct inotify_event *event = (const struct inotify_event *) (buf + i);
+        i += sizeof(struct inotify_event) + event->len;
+        if (event->len == 0) {
+            relevant = true;
+            continue;
+        }
+
+        // The first watch is /dev, the others are /dev/bus/usb/<bus>
+        char node[DEVICE_NODE_LEN] = "";
+        if (event->wd == 1) {
+            if (strncmp(event->name, "tty", 3) != 0) continue;
+            snprintf(node, sizeof(node), "%s", event->name);
+        } else {
+            for (size_t j = 0; j < monitor_bus_count; j++) {
+                if (monitor_buses[j].wd == event->wd) {
+                    snprintf(node, sizeof(node), "bus/usb/%s/%s", monitor_buses[j].bus, event->name);
+                }
+            }
+        }
+        relevant = true;
+        if ((event->mask & IN_DELETE) && node[0] != '\0') {
+            record_removed(node);
+        }
+    }
+    return relevant;
+}
+
+static int open_netlink(void) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_nl addr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid = 0,
+            .nl_groups = 1,   // kernel uevents
+    };
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_inotify(void) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // First watch is /dev itself, see inotify_relevant()
+    monitor_bus_count = 0;
+    if (inotify_add_watch(fd, "/dev", IN_CREATE | IN_DELETE) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    DIR *dir = opendir("/dev/bus/usb");
+    if (dir != NULL) {
+        struct dirent *entry;
+        char path[300];
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            snprintf(path, sizeof(path), "/dev/bus/usb/%s", entry->d_name);
+            int wd = inotify_add_watch(fd, path, IN_CREATE | IN_DELETE);
+            if (wd >= 0 && monitor_bus_count < MAX_USB_BUSES && strlen(entry->d_name) < sizeof(monitor_buses[0].bus)) {
+                monitor_buses[monitor_bus_count].wd = wd;
+                strcpy(monitor_buses[monitor_bus_count++].bus, entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    return fd;
+}
+
+static void *monitor_main(void *arg) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+            {.fd = monitor_event_fd, .events = POLLIN},
+            {.fd = monitor_stop_fd, .events = POLLIN},
+    };
+    bool pending = false;
+
+    while (true) {
+        // Let a burst of events settle before rescanning
+        int ret = poll(fds, 2, pending ? DEVICE_SETTLE_MS : -1);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+        if (ret == 0) {
+            pending = false;
+            device_registry_refresh();
+            continue;
+        }
+
+        ssize_t len = read(monitor_event_fd, buf, sizeof(buf) - 1);
+        if (len <= 0) continue;
+        buf[len] = '\0';
+
+        if (monitor_netlink ? uevent_relevant(buf, len) : inotify_relevant(buf, len)) {
+            pending = true;
+        }
+    }
+    return NULL;
+}
+
+// Start watching for readers being plugged in or removed
+bool device_registry_watch(void) {
+    if (monitor_running) {
+        return true;
+    }
+
+    monitor_event_fd = open_netlink();
+    monitor_netlink = monitor_event_fd >= 0;
+    if (!monitor_netlink) {
+        lverbose("Netlink uevents unavailable, watching /dev instead.\n");
+        monitor_event_fd = open_inotify();
+    }
+    if (monitor_event_fd < 0) {
+        lwarning("Unable to watch for reader hotplug, readers are only listed on demand.\n");
+        return false;
+    }
+
+    monitor_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (monitor_stop_fd < 0 || pthread_create(&monitor_thread, NULL, monitor_main, NULL) != 0) {
+        lwarning("Unable to start reader monitor.\n");
+        close(monitor_event_fd);
+        if (monitor_stop_fd >= 0) close(monitor_stop_fd);
+        monitor_event_fd = monitor_stop_fd = -1;
+        return false;
+    }
+
+    monitor_running = true;
+    return true;
+}
+
+void device_registry_unwatch(void) {
+    if (!monitor_running) {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(monitor_stop_fd, &one, sizeof(one)) == sizeof(one)) {
+        pthread_join(monitor_thread, NULL);
+    } else {
+        pthread_cancel(monitor_thread);
+        pthread_join(monitor_thread, NULL);
+    }
+
+    close(monitor_event_fd);
+    close(monitor_stop_fd);
+    monitor_event_fd = monitor_stop_fd = -1;
+    monitor_running = false;
+}
+
+bool device_registry_watching(void) {
+    return monitor_running;
+}
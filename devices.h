@@ -0,0 +1,51 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_DEVICES_H__
+#define __NFC_SRIX_DEVICES_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Macros */
+#define MAX_DEVICE_LISTENERS 8
+#define DEVICE_SETTLE_MS 300
+#define DEVICE_NODE_LEN 64
+#define MAX_USB_BUSES 32
+
+/*
+ * Called from the monitor thread after the set of readers changed.
+ * device_registry_remove_listener waits for a call in progress, so data may
+ * live on the caller's stack. Listeners must not add or remove listeners.
+ */
+typedef void (*device_listener)(void *data, const nfc_connstring *connstrings, size_t count, uint32_t generation);
+
+/* Registry */
+size_t device_registry_refresh(void);
+size_t device_registry_list(nfc_connstring *connstrings, size_t max, uint32_t *generation);
+bool device_registry_contains(const char *connstring);
+bool device_registry_hold(const char *connstring);
+void device_registry_release(const char *connstring);
+
+/* Hotplug */
+bool device_registry_watch(void);
+void device_registry_unwatch(void);
+bool device_registry_watching(void);
+bool device_registry_add_listener(device_listener listener, void *data);
+void device_registry_remove_listener(device_listener listener, void *data);
+
+#endif // __NFC_SRIX_DEVICES_H__
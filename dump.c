@@ -0,0 +1,581 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "output.h"
+#include "tag_profile.h"
+#include "dump.h"
+#include "trace.h"
+
+/*
+ * Parsers work on the mapped file and never copy it, every format ends up as
+ * a plain EEPROM image of up to SRIX4K_EEPROM_BLOCKS blocks.
+ */
+
+bool parse_dump_format(const char *name, dump_format *format) {
+    if (strcmp(name, "auto") == 0) {
+        *format = DUMP_FORMAT_AUTO;
+    } else if (strcmp(name, "raw") == 0 || strcmp(name, "bin") == 0) {
+        *format = DUMP_FORMAT_RAW;
+    } else if (strcmp(name, "eml") == 0) {
+        *format = DUMP_FORMAT_EML;
+    } else if (strcmp(name, "json") == 0) {
+        *format = DUMP_FORMAT_JSON;
+    } else if (strcmp(name, "hex") == 0 || strcmp(name, "txt") == 0) {
+        *format = DUMP_FORMAT_HEX;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Format from the file extension, DUMP_FORMAT_AUTO if unknown
+dump_format dump_format_from_path(const char *path) {
+    dump_format format = DUMP_FORMAT_AUTO;
+    const char *ext = strrchr(path, '.');
+    if (ext == NULL || strchr(ext, '/') != NULL) {
+        return DUMP_FORMAT_AUTO;
+    }
+
+    char name[8] = {};
+    for (int i = 0; i < 7 && ext[i + 1]; i++) {
+        name[i] = (char) (ext[i + 1] | 0x20);
+    }
+    if (strcmp(name, "dump") == 0) {
+        return DUMP_FORMAT_RAW;
+    }
+    if (!parse_dump_format(name, &format)) {
+        return DUMP_FORMAT_AUTO;
+    }
+    return format;
+}
+
+const char *dump_format_extension(dump_format format) {
+    switch (format) {
+        case DUMP_FORMAT_EML: return ".eml";
+        case DUMP_FORMAT_JSON: return ".json";
+        case DUMP_FORMAT_HEX: return ".txt";
+        default: return ".bin";
+    }
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    return p;
+}
+
+static const char *line_end(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', end - p);
+    return nl != NULL ? nl : end;
+}
+
+// 4 bytes as 8 hex digits, single blanks between bytes allowed
+static const char *parse_block_hex(const char *p, const char *end, uint8_t *block) {
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) p = skip_blanks(p, end);
+        if (end - p < 2 || hex_value(p[0]) < 0 || hex_value(p[1]) < 0) return NULL;
+        block[i] = (uint8_t) (hex_value(p[0]) << 4u | hex_value(p[1]));
+        p += 2;
+    }
+    return p;
+}
+
+// 16 hex digits, MSB first as printed, into a GET_UID frame
+static bool parse_uid_hex(const char *p, const char *end, uint8_t *uid) {
+    for (int i = 0; i < 8; i++) {
+        if (end - p < 2 || hex_value(p[0]) < 0 || hex_value(p[1]) < 0) return false;
+        uid[7 - i] = (uint8_t) (hex_value(p[0]) << 4u | hex_value(p[1]));
+        p += 2;
+    }
+    return true;
+}
+
+static bool parse_error(char *error, const char *format, ...) {
+    if (error != NULL) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(error, DUMP_ERROR_LEN, format, args);
+        va_end(args);
+    }
+    return false;
+}
+
+// Proxmark appends the system block right after the last EEPROM block
+static void split_system_block(uint8_t *image, dump_info *info) {
+    if (info->blocks == SRI512_EEPROM_BLOCKS + 1 && !info->has_system) {
+        info->blocks--;
+        memcpy(info->system, image + info->blocks * 4, 4);
+        info->has_system = true;
+    }
+}
+
+// Store block at address, the one past a full SRIX4K image is the system block
+static bool store_block(uint32_t address, const uint8_t *block, uint8_t *image, dump_info *info) {
+    if (address == SRIX_SYSTEM_BLOCK || address == SRIX4K_EEPROM_BLOCKS) {
+        memcpy(info->system, block, 4);
+        info->has_system = true;
+        return true;
+    }
+    if (address >= SRIX4K_EEPROM_BLOCKS) {
+        return false;
+    }
+    memcpy(image + address * 4, block, 4);
+    return true;
+}
+
+static bool parse_eml(const char *p, const char *end, uint8_t *image, dump_info *info, char *error) {
+    unsigned long line = 0;
+    uint32_t count = 0;
+    while (p < end) {
+        const char *eol = line_end(p, end);
+        line++;
+
+        const char *q = skip_blanks(p, eol);
+        if (q < eol) {
+            uint8_t block[4];
+            q = parse_block_hex(q, eol, block);
+            if (q == NULL || skip_blanks(q, eol) != eol) return parse_error(error, "expected 8 hex digits at line %lu", line);
+            if (count > SRIX4K_EEPROM_BLOCKS || !store_block(count, block, image, info)) return parse_error(error, "too many blocks at line %lu", line);
+            count++;
+            if (count <= SRIX4K_EEPROM_BLOCKS) info->blocks = count;
+        }
+        p = eol + 1;
+    }
+    split_system_block(image, info);
+    return true;
+}
+
+static bool parse_hex(const char *p, const char *end, uint8_t *image, dump_info *info, char *error) {
+    uint8_t seen[SRIX4K_EEPROM_BLOCKS] = {};
+    unsigned long line = 0;
+    uint32_t next = 0;
+
+    while (p < end) {
+        const char *eol = line_end(p, end);
+        const char *q = skip_blanks(p, eol);
+        line++;
+        p = eol + 1;
+
+        // Only "[XX] ..." and bare hex lines carry data
+        uint32_t block = next;
+        if (q < eol && *q == '[') {
+            if (eol - q < 4 || hex_value(q[1]) < 0 || hex_value(q[2]) < 0 || q[3] != ']') return parse_error(error, "bad block address at line %lu", line);
+            block = hex_value(q[1]) << 4u | hex_value(q[2]);
+            q = skip_blanks(q + 4, eol);
+        } else if (q >= eol || hex_value(*q) < 0) {
+            continue;
+        }
+
+        uint8_t data[4];
+        if (parse_block_hex(q, eol, data) == NULL) return parse_error(error, "expected 4 hex bytes at line %lu", line);
+        if (!store_block(block, data, image, info)) return parse_error(error, "block out of range at line %lu", line);
+        next = block + 1;
+        if (block >= SRIX4K_EEPROM_BLOCKS) continue;
+        seen[block] = 1;
+        if (next > info->blocks) info->blocks = next;
+    }
+    split_system_block(image, info);
+
+    for (uint32_t i = 0; i < info->blocks; i++) {
+        if (!seen[i]) return parse_error(error, "missing block %02X", i);
+    }
+    return true;
+}
+
+// Bounded decimal, the mapping is not NUL terminated
+static const char *parse_dec(const char *p, const char *end, uint32_t *value) {
+    const char *start = p;
+    *value = 0;
+    while (p < end && *p >= '0' && *p <= '9' && p - start < 9) {
+        *value = *value * 10 + (*p - '0');
+        p++;
+    }
+    return p == start ? NULL : p;
+}
+
+// Position after "key": inside [p, end), or NULL
+static const char *json_find_key(const char *p, const char *end, const char *key) {
+    size_t key_len = strlen(key);
+    while (p < end) {
+        const char *quote = memchr(p, '"', end - p);
+        if (quote == NULL || end - quote < (long) key_len + 2) return NULL;
+        if (memcmp(quote + 1, key, key_len) == 0 && quote[key_len + 1] == '"') {
+            const char *q = skip_space(quote + key_len + 2, end);
+            if (q < end && *q == ':') return skip_space(q + 1, end);
+        }
+        p = quote + 1;
+    }
+    return NULL;
+}
+
+static const char *json_block_string(const char *p, const char *end, uint8_t *block) {
+    if (p >= end || *p != '"') return NULL;
+    p = parse_block_hex(p + 1, end, block);
+    if (p == NULL || p >= end || *p != '"') return NULL;
+    return p + 1;
+}
+
+static bool parse_json(const char *p, const char *end, uint8_t *image, dump_info *info, char *error) {
+    const char *uid = json_find_key(p, end, "UID");
+    if (uid != NULL && uid < end && *uid == '"' && parse_uid_hex(uid + 1, end, info->uid)) {
+        info->has_uid = true;
+    }
+
+    const char *q = json_find_key(p, end, "blocks");
+    if (q == NULL || q >= end || (*q != '{' && *q != '[')) return parse_error(error, "no \"blocks\" in JSON");
+    char close = *q == '{' ? '}' : ']';
+    bool object = *q == '{';
+    uint8_t seen[SRIX4K_EEPROM_BLOCKS] = {};
+    uint32_t index = 0;
+
+    q = skip_space(q + 1, end);
+    while (q < end && *q != close) {
+        uint8_t block[4];
+        uint32_t address = index;
+
+        if (object) {
+            // "12": "AABBCCDD"
+            if (*q != '"') return parse_error(error, "bad block key near offset %ld", (long) (q - p));
+            const char *num_end = parse_dec(q + 1, end, &address);
+            if (num_end == NULL || num_end >= end || *num_end != '"') return parse_error(error, "bad block key near offset %ld", (long) (q - p));
+            q = skip_space(num_end + 1, end);
+            if (q >= end || *q != ':') return parse_error(error, "expected ':' near offset %ld", (long) (q - p));
+            q = json_block_string(skip_space(q + 1, end), end, block);
+        } else if (*q == '{') {
+            // {"block": 12, "data": "AABBCCDD", ...}
+            const char *obj_end = memchr(q, '}', end - q);
+            if (obj_end == NULL) return parse_error(error, "unterminated block near offset %ld", (long) (q - p));
+            const char *number = json_find_key(q, obj_end, "block");
+            const char *data = json_find_key(q, obj_end, "data");
+            if (number != NULL && parse_dec(number, obj_end, &address) == NULL) return parse_error(error, "bad block number near offset %ld", (long) (q - p));
+            if (data == NULL || json_block_string(data, obj_end, block) == NULL) return parse_error(error, "bad block data near offset %ld", (long) (q - p));
+            q = obj_end + 1;
+        } else {
+            // "AABBCCDD"
+            q = json_block_string(q, end, block);
+        }
+
+        if (q == NULL) return parse_error(error, "expected \"AABBCCDD\" for block %u", address);
+        if (!store_block(address, block, image, info)) return parse_error(error, "block %u out of range", address);
+
+        if (address < SRIX4K_EEPROM_BLOCKS) {
+            seen[address] = 1;
+            if (address + 1 > info->blocks) info->blocks = address + 1;
+        }
+        index++;
+
+        q = skip_space(q, end);
+        if (q < end && *q == ',') q = skip_space(q + 1, end);
+    }
+    if (q >= end) return parse_error(error, "unterminated \"blocks\"");
+    split_system_block(image, info);
+
+    for (uint32_t i = 0; i < info->blocks; i++) {
+        if (!seen[i]) return parse_error(error, "missing block %02X", i);
+    }
+    return true;
+}
+
+// Plain EEPROM bytes, optionally followed by the system block
+static bool parse_raw(const char *data, size_t len, uint8_t *image, dump_info *info, bool prefix, char *error) {
+    const srix_tag_profile *profile = srix_profile_from_size(len);
+    if (profile == NULL && len >= 4) {
+        profile = srix_profile_from_size(len - 4);
+    }
+
+    if (profile != NULL) {
+        info->blocks = profile->blocks;
+        memcpy(image, data, profile->eeprom_size);
+        if (len > profile->eeprom_size) {
+            memcpy(info->system, data + profile->eeprom_size, 4);
+            info->has_system = true;
+        }
+        return true;
+    }
+
+    // Loading for a tag has always taken the first bytes of a longer file
+    if (!prefix) {
+        return parse_error(error, "raw dump of %zu bytes is neither %u nor %u bytes, with or without the system block", len, SRI512_EEPROM_SIZE, SRIX4K_EEPROM_SIZE);
+    }
+    size_t size = len < SRIX4K_EEPROM_SIZE ? len - len % 4 : SRIX4K_EEPROM_SIZE;
+    info->blocks = size / 4;
+    memcpy(image, data, size);
+    return true;
+}
+
+static bool is_raw_size(size_t len) {
+    return srix_profile_from_size(len) != NULL || (len >= 4 && srix_profile_from_size(len - 4) != NULL);
+}
+
+static bool parse_data(const char *data, size_t len, dump_format format, uint8_t *image, dump_info *info, bool prefix, char *error) {
+    memset(info, 0, sizeof(*info));
+
+    if (format == DUMP_FORMAT_AUTO) {
+        const char *p = skip_space(data, data + len);
+        if (is_raw_size(len)) {
+            format = DUMP_FORMAT_RAW;
+        } else if (p < data + len && *p == '{') {
+            format = DUMP_FORMAT_JSON;
+        } else if (p < data + len && *p == '[') {
+            format = DUMP_FORMAT_HEX;
+        } else {
+            format = DUMP_FORMAT_EML;
+        }
+    }
+
+    switch (format) {
+        case DUMP_FORMAT_RAW:
+            return parse_raw(data, len, image, info, prefix, error);
+        case DUMP_FORMAT_EML:
+            return parse_eml(data, data + len, image, info, error);
+        case DUMP_FORMAT_JSON:
+            return parse_json(data, data + len, image, info, error);
+        case DUMP_FORMAT_HEX:
+        default:
+            return parse_hex(data, data + len, image, info, error);
+    }
+}
+
+/*
+ * Parse a dump held in memory into image (SRIX4K_EEPROM_SIZE bytes).
+ * A raw dump is exactly one tag image, with or without the system block.
+ * error, if not NULL, receives up to DUMP_ERROR_LEN bytes describing a failure.
+ */
+bool dump_parse(const char *data, size_t len, dump_format format, uint8_t *image, dump_info *info, char *error) {
+    return parse_data(data, len, format, image, info, false, error);
+}
+
+/*
+ * Render image into buf, which should hold DUMP_MAX_TEXT_LEN bytes.
+ * Returns the number of bytes written, 0 if buf is too small.
+ */
+size_t dump_render(char *buf, size_t buf_size, const uint8_t *image, const dump_info *info, dump_format format) {
+    static const char hex[] = "0123456789ABCDEF";
+    char *p = buf;
+    char *end = buf + buf_size;
+
+    switch (format) {
+        case DUMP_FORMAT_HEX: {
+            size_t len = output_render_eeprom(buf, buf_size, image, info->blocks, NULL, OUTPUT_HEX, false);
+            if (info->has_system && len > 0) {
+                const uint8_t *block = info->system;
+                int n = snprintf(buf + len, buf_size - len, "[%02X] %02X %02X %02X %02X --- System\n", SRIX_SYSTEM_BLOCK, block[0], block[1], block[2], block[3]);
+                len = n < (int) (buf_size - len) ? len + n : 0;
+            }
+            return len;
+        }
+
+        case DUMP_FORMAT_EML:
+            if (buf_size < (info->blocks + 1) * 9) return 0;
+            for (uint32_t i = 0; i <= info->blocks; i++) {
+                const uint8_t *block = i < info->blocks ? image + i * 4 : info->system;
+                if (i == info->blocks && !info->has_system) break;
+                for (int j = 0; j < 4; j++) {
+                    *p++ = hex[block[j] >> 4u];
+                    *p++ = hex[block[j] & 0xFu];
+                }
+                *p++ = '\n';
+            }
+            return p - buf;
+
+        case DUMP_FORMAT_JSON: {
+            char uid[17] = {};
+            if (info->has_uid) srix_uid_to_string(info->uid, uid);
+
+            int n = snprintf(p, end - p, "{\n  \"Created\": \"nfc-srix\",\n  \"FileType\": \"srix\",\n");
+            if (info->has_uid) n += snprintf(p + n, end - p - n, "  \"Card\": {\n    \"UID\": \"%s\"\n  },\n", uid);
+            n += snprintf(p + n, end - p - n, "  \"blocks\": {\n");
+            p += n;
+            uint32_t last = info->has_system ? info->blocks : info->blocks - 1;
+            for (uint32_t i = 0; i <= last && p < end; i++) {
+                const uint8_t *block = i < info->blocks ? image + i * 4 : info->system;
+                p += snprintf(p, end - p, "    \"%u\": \"%02X%02X%02X%02X\"%s\n", i, block[0], block[1], block[2], block[3], i < last ? "," : "");
+            }
+            if (p < end) p += snprintf(p, end - p, "  }\n}\n");
+            return p < end ? (size_t) (p - buf) : 0;
+        }
+
+        case DUMP_FORMAT_RAW:
+        default:
+            if (buf_size < (info->blocks + 1) * 4) return 0;
+            memcpy(buf, image, info->blocks * 4);
+            if (!info->has_system) return info->blocks * 4;
+            memcpy(buf + info->blocks * 4, info->system, 4);
+            return (info->blocks + 1) * 4;
+    }
+}
+
+// Map path and parse it in place
+static bool dump_map_file(const char *path, dump_format format, uint8_t *image, dump_info *info, bool prefix, char *error) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return parse_error(error, "cannot open file");
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || file_stat.st_size == 0) {
+        close(fd);
+        return parse_error(error, "empty or unreadable file");
+    }
+
+    void *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return parse_error(error, "cannot map file");
+    }
+
+    if (format == DUMP_FORMAT_AUTO) {
+        format = dump_format_from_path(path);
+    }
+    bool ok = parse_data(data, file_stat.st_size, format, image, info, prefix, error);
+    if (!ok && prefix && format == DUMP_FORMAT_AUTO && file_stat.st_size >= SRI512_EEPROM_SIZE) {
+        // Not text after all, read it the way raw dumps always were
+        ok = parse_data(data, file_stat.st_size, DUMP_FORMAT_RAW, image, info, true, error);
+    }
+    munmap(data, file_stat.st_size);
+
+    return ok;
+}
+
+bool dump_load_file(const char *path, dump_format format, uint8_t *image, dump_info *info, char *error) {
+    TRACE1(dump_load_start, path);
+    bool ok = dump_map_file(path, format, image, info, false, error);
+    TRACE2(dump_load_done, path, ok);
+    return ok;
+}
+
+/*
+ * Load a dump in any supported format into dump (SRIX4K_EEPROM_SIZE bytes).
+ * Unlike dump_load_file, a raw file longer than the tag keeps its first bytes.
+ * With pick_profile the tag profile follows the dump size unless -t was given.
+ * Prints an error and returns false on failure.
+ */
+bool dump_load(const char *path, uint8_t *dump, bool pick_profile) {
+    dump_info info;
+    char error[DUMP_ERROR_LEN];
+
+    lverbose("Reading \"%s\"...\n", path);
+    TRACE1(dump_load_start, path);
+    bool ok = dump_map_file(path, DUMP_FORMAT_AUTO, dump, &info, true, error);
+    TRACE2(dump_load_done, path, ok);
+    if (!ok) {
+        lerror("Cannot load \"%s\": %s.\n", path, error);
+        return false;
+    }
+
+    if (pick_profile && !tag_profile_forced && srix_profile_from_size(info.blocks * 4) != NULL) {
+        set_tag_profile(srix_profile_from_size(info.blocks * 4));
+    }
+    if (info.blocks < eeprom_blocks_amount) {
+        lerror("Dump has %u blocks, expected %u.\n", info.blocks, eeprom_blocks_amount);
+        return false;
+    }
+
+    return true;
+}
+
+// Write image to path with a single write
+static bool write_file(const char *path, const char *buf, size_t len, bool durable) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t ret = write(fd, buf + done, len - done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) {
+            close(fd);
+            return false;
+        }
+        done += ret;
+    }
+    if (durable && fdatasync(fd) != 0) {
+        close(fd);
+        return false;
+    }
+    return close(fd) == 0;
+}
+
+static bool dump_write_file(const char *path, const uint8_t *image, const dump_info *info, dump_format format, bool durable) {
+    char buf[DUMP_MAX_TEXT_LEN];
+
+    if (format == DUMP_FORMAT_AUTO) {
+        format = dump_format_from_path(path);
+    }
+    size_t len = dump_render(buf, sizeof(buf), image, info, format);
+    if (len == 0) {
+        return false;
+    }
+
+    if (!durable) {
+        return write_file(path, buf, len, false);
+    }
+
+    // Never leave a torn dump behind: write aside, sync, then replace
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int) sizeof(tmp_path)) {
+        return false;
+    }
+    if (!write_file(tmp_path, buf, len, true) || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return sync_parent_dir(path);
+}
+
+static bool dump_write(const char *path, const uint8_t *image, const dump_info *info, dump_format format, bool durable) {
+    TRACE2(dump_save_start, path, durable);
+    bool ok = dump_write_file(path, image, info, format, durable);
+    TRACE2(dump_save_done, path, ok);
+    return ok;
+}
+
+bool dump_save(const char *path, const uint8_t *image, const dump_info *info, dump_format format) {
+    return dump_write(path, image, info, format, false);
+}
+
+// On disk when it returns, for single dumps taken from a tag
+bool dump_save_durable(const char *path, const uint8_t *image, const dump_info *info, dump_format format) {
+    return dump_write(path, image, info, format, true);
+}
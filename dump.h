@@ -0,0 +1,58 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_DUMP_H__
+#define __NFC_SRIX_DUMP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Macros */
+#define DUMP_MAX_TEXT_LEN 16384
+#define DUMP_ERROR_LEN 128
+
+typedef enum {
+    DUMP_FORMAT_AUTO,
+    DUMP_FORMAT_RAW,      // plain EEPROM bytes
+    DUMP_FORMAT_EML,      // Proxmark emulator file, one block per line
+    DUMP_FORMAT_JSON,     // Proxmark JSON, also reads our -o json listing
+    DUMP_FORMAT_HEX,      // "[00] AA BB CC DD" hex text, also reads our -o hex listing
+} dump_format;
+
+typedef struct {
+    uint32_t blocks;
+    bool has_uid;
+    srix_uid_frame uid;   // LSB first, as received from GET_UID
+    bool has_system;
+    uint8_t system[4];    // SRIX_SYSTEM_BLOCK when the dump carries it
+} dump_info;
+
+bool parse_dump_format(const char *name, dump_format *format);
+dump_format dump_format_from_path(const char *path);
+const char *dump_format_extension(dump_format format);
+
+/* Parsing and rendering, no global state */
+bool dump_parse(const char *data, size_t len, dump_format format, uint8_t *image, dump_info *info, char *error);
+size_t dump_render(char *buf, size_t buf_size, const uint8_t *image, const dump_info *info, dump_format format);
+
+/* Files */
+bool dump_load(const char *path, uint8_t *dump, bool pick_profile);
+bool dump_load_file(const char *path, dump_format format, uint8_t *image, dump_info *info, char *error);
+bool dump_save(const char *path, const uint8_t *image, const dump_info *info, dump_format format);
+bool dump_save_durable(const char *path, const uint8_t *image, const dump_info *info, dump_format format);
+
+#endif // __NFC_SRIX_DUMP_H__
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "logging.h"
+#include "emu_tag.h"
+
+static const uint8_t emu_tag_uid[8] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x0C, 0x02, 0xD0};
+
+static void emu_tag_sleep(uint32_t us) {
+    if (us == 0) return;
+    struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000L};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+void emu_tag_init(srix_emu_tag *tag) {
+    memset(tag, 0, sizeof(srix_emu_tag));
+    memcpy(tag->uid, emu_tag_uid, sizeof(tag->uid));
+    memset(tag->eeprom, 0xFF, sizeof(tag->eeprom));
+    tag->latency_us = EMU_TAG_DEFAULT_LATENCY_US;
+    tag->seed = 1;
+    tag->present = 1;
+}
+
+// Comma separated wear=N, latency=US and seed=S
+bool emu_tag_configure(srix_emu_tag *tag, const char *spec) {
+    while (*spec != '\0') {
+        char *end;
+        unsigned long value;
+
+        if (strncmp(spec, "wear=", 5) == 0) {
+            value = strtoul(spec + 5, &end, 10);
+            if (end == spec + 5) return false;
+            tag->wear = value;
+        } else if (strncmp(spec, "latency=", 8) == 0) {
+            value = strtoul(spec + 8, &end, 10);
+            if (end == spec + 8 || value > 1000000) return false;
+            tag->latency_us = value;
+        } else if (strncmp(spec, "seed=", 5) == 0) {
+            value = strtoul(spec + 5, &end, 10);
+            if (end == spec + 5) return false;
+            tag->seed = value;
+        } else {
+            return false;
+        }
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return false;
+        spec = end;
+    }
+    return true;
+}
+
+// How far past its rated writes a block is, 0 while healthy
+static double emu_tag_wear(const srix_emu_tag *tag, uint8_t block) {
+    if (tag->wear == 0 || tag->writes[block] <= tag->wear) return 0;
+    return (double) (tag->writes[block] - tag->wear) / tag->wear;
+}
+
+// SRx frame sent to the tag, returns the answer length or -1 for no answer
+int emu_tag_frame(srix_emu_tag *tag, const uint8_t *tx, size_t tx_size, uint8_t *rx) {
+    if (!tag->present || tx_size == 0) {
+        return -1;
+    }
+
+    switch (tx[0]) {
+        case 0x06: // INITIATE
+            rx[0] = EMU_TAG_CHIP_ID;
+            return 1;
+        case 0x0E: // SELECT
+            if (tx_size < 2 || tx[1] != EMU_TAG_CHIP_ID) return -1;
+            rx[0] = EMU_TAG_CHIP_ID;
+            return 1;
+        case 0x0B: // GET_UID
+            memcpy(rx, tag->uid, sizeof(tag->uid));
+            return sizeof(tag->uid);
+        case 0x08: // READ_BLOCK
+            if (tx_size < 2 || tx[1] >= EMU_TAG_BLOCKS) return -1;
+            emu_tag_sleep(tag->latency_us / 4);
+            memcpy(rx, tag->eeprom + tx[1] * 4, 4);
+            return 4;
+        case 0x09: { // WRITE_BLOCK, no answer
+            if (tx_size != 6 || tx[1] >= EMU_TAG_BLOCKS) return -1;
+            uint8_t block = tx[1];
+            tag->writes[block]++;
+
+            double worn = emu_tag_wear(tag, block);
+            emu_tag_sleep(tag->latency_us * (1.0 + worn));
+            memcpy(tag->eeprom + block * 4, tx + 2, 4);
+
+            // A worn cell keeps a wrong bit, certainly once twice past its rating
+            if (worn > 0 && rand_r(&tag->seed) < worn * RAND_MAX) {
+                int bit = rand_r(&tag->seed) % 32;
+                tag->eeprom[block * 4 + bit / 8] ^= 1u << (bit % 8);
+            }
+            return -1;
+        }
+        default:
+            return -1;
+    }
+}
+
+static bool emu_tag_select(void *ctx, uint8_t *uid) {
+    srix_emu_tag *tag = ctx;
+    tag->aborted = 0;
+    while (!tag->present && !tag->aborted) {
+        emu_tag_sleep(10000);
+    }
+    if (tag->aborted) return false;
+
+    memcpy(uid, tag->uid, sizeof(tag->uid));
+    return true;
+}
+
+static bool emu_tag_is_present(void *ctx) {
+    return ((srix_emu_tag *) ctx)->present;
+}
+
+static int emu_tag_transceive(void *ctx, const uint8_t *tx, size_t tx_size, uint8_t *rx, size_t rx_size) {
+    uint8_t answer[8];
+    int len = emu_tag_frame(ctx, tx, tx_size, answer);
+    if (len < 0) {
+        return rx_size == 0 ? 0 : -1;
+    }
+    if ((size_t) len > rx_size) {
+        return -1;
+    }
+    memcpy(rx, answer, len);
+    return len;
+}
+
+static void emu_tag_abort(void *ctx) {
+    ((srix_emu_tag *) ctx)->aborted = 1;
+}
+
+static void emu_tag_close(void *ctx) {
+    free(ctx);
+}
+
+/*
+ * Tag that never leaves the field, "emulated:wear=N,latency=US,seed=S".
+ * Prints an error and returns NULL on a bad spec.
+ */
+srix_transport *emu_tag_open(const char *connstring) {
+    if (strncmp(connstring, EMU_TAG_PREFIX, strlen(EMU_TAG_PREFIX)) == 0) {
+        connstring += strlen(EMU_TAG_PREFIX);
+    }
+
+    srix_emu_tag *tag = malloc(sizeof(srix_emu_tag));
+    if (tag == NULL) {
+        return NULL;
+    }
+    emu_tag_init(tag);
+    if (!emu_tag_configure(tag, connstring)) {
+        lerror("Invalid emulated tag \"%s\", expected wear=N,latency=US,seed=S.\n", connstring);
+        free(tag);
+        return NULL;
+    }
+
+    tag->transport = (srix_transport) {
+            .name = "emulated",
+            .select = emu_tag_select,
+            .is_present = emu_tag_is_present,
+            .transceive = emu_tag_transceive,
+            .abort = emu_tag_abort,
+            .close = emu_tag_close,
+            .ctx = tag,
+    };
+    return &tag->transport;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_EMU_TAG_H__
+#define __NFC_SRIX_EMU_TAG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+#include "transport.h"
+
+/* Macros */
+#define EMU_TAG_PREFIX "emulated:"
+#define EMU_TAG_BLOCKS 128
+#define EMU_TAG_CHIP_ID 0x2A
+#define EMU_TAG_DEFAULT_LATENCY_US 3000
+
+/*
+ * SRIX4K in software. With wear set, a block written more than wear times
+ * gets slower and starts keeping a flipped bit, more so the further it goes.
+ */
+typedef struct {
+    uint8_t uid[8];
+    uint8_t eeprom[EMU_TAG_BLOCKS * 4];
+    uint32_t writes[EMU_TAG_BLOCKS];
+    uint32_t wear;                // writes per block before degrading, 0 = never
+    uint32_t latency_us;          // write time of a fresh block, reads take a quarter
+    unsigned int seed;
+    volatile sig_atomic_t present;
+    volatile sig_atomic_t aborted;
+    srix_transport transport;
+} srix_emu_tag;
+
+void emu_tag_init(srix_emu_tag *tag);
+bool emu_tag_configure(srix_emu_tag *tag, const char *spec);
+int emu_tag_frame(srix_emu_tag *tag, const uint8_t *tx, size_t tx_size, uint8_t *rx);
+
+/* Transport */
+srix_transport *emu_tag_open(const char *connstring);
+
+#endif // __NFC_SRIX_EMU_TAG_H__
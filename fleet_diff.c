@@ -0,0 +1,460 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "dump.h"
+#include "fleet_index.h"
+#include "journal.h"
+#include "fleet_diff.h"
+
+/*
+ * Fleet snapshot diff as a partitioned hash join.
+ * Each side is streamed once into FLEET_DIFF_PARTITIONS spill files of
+ * (UID, locator) entries. Workers then take one partition at a time, sort
+ * both halves by UID and merge them, loading images only for matching UIDs.
+ * Memory holds one partition per worker, never a whole collection.
+ */
+
+typedef struct {
+    uint64_t uid;
+    uint64_t offset;                    // image offset in a journal
+    uint32_t blocks;                    // journal record blocks
+    char name[FLEET_DIFF_NAME_LEN];     // file name in a directory
+} diff_entry;
+
+typedef struct {
+    const char *path;
+    bool journal;
+    const uint8_t *map;                 // journal, paged in on demand
+    size_t map_len;
+    FILE *partitions[FLEET_DIFF_PARTITIONS];
+    uint64_t scan_offset;
+    bool spill_failed;
+} diff_side;
+
+typedef struct {
+    diff_side *before;
+    diff_side *after;
+    uint32_t next_partition;
+
+    pthread_mutex_t lock;               // output and totals
+    FILE *out;
+    bool write_failed;
+    uint64_t block_changes[SRIX4K_EEPROM_BLOCKS];
+    uint64_t both, changed, only_before, only_after, resized, unreadable;
+} diff_job;
+
+static uint32_t diff_partition(uint64_t uid) {
+    return (uint32_t) ((uid * 0x9E3779B97F4A7C15ull) >> 32u) % FLEET_DIFF_PARTITIONS;
+}
+
+static bool diff_spill(diff_side *side, const diff_entry *entry) {
+    return fwrite(entry, sizeof(diff_entry), 1, side->partitions[diff_partition(entry->uid)]) == 1;
+}
+
+/*
+ * Records follow each other from offset 0, so the image offset is a running sum.
+ * journal_scan maps the file again, records a live station appended after
+ * side->map was taken are left out.
+ */
+static bool diff_journal_visitor(void *data, const uint8_t *uid, uint64_t time_ms, const uint8_t *image, uint32_t blocks) {
+    diff_side *side = data;
+    diff_entry entry = {.uid = srix_uid_to_u64(uid), .offset = side->scan_offset + JOURNAL_HEADER_LEN, .blocks = blocks};
+    if (entry.offset + blocks * 4 > side->map_len) {
+        return false;
+    }
+    side->scan_offset += JOURNAL_HEADER_LEN + blocks * 4;
+    side->spill_failed = !diff_spill(side, &entry);
+    return !side->spill_failed;
+}
+
+static bool diff_scan_directory(diff_side *side) {
+    DIR *dir = opendir(side->path);
+    if (dir == NULL) {
+        lerror("Cannot open \"%s\".\n", side->path);
+        return false;
+    }
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        diff_entry entry = {};
+        if (!parse_uid_name(dirent->d_name, &entry.uid)) continue;
+        if (strlen(dirent->d_name) >= FLEET_DIFF_NAME_LEN) {
+            lwarning("Skipped \"%s\", name too long.\n", dirent->d_name);
+            continue;
+        }
+        strcpy(entry.name, dirent->d_name);
+        if (!diff_spill(side, &entry)) {
+            closedir(dir);
+            lerror("Cannot write temporary partition.\n");
+            return false;
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+// Partition a directory of <UID> dumps or a station journal
+static bool diff_side_open(diff_side *side, const char *path) {
+    memset(side, 0, sizeof(diff_side));
+    side->path = path;
+
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        lerror("Cannot open \"%s\".\n", path);
+        return false;
+    }
+    for (uint32_t i = 0; i < FLEET_DIFF_PARTITIONS; i++) {
+        side->partitions[i] = tmpfile();
+        if (side->partitions[i] == NULL) {
+            lerror("Cannot create temporary partitions.\n");
+            return false;
+        }
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return diff_scan_directory(side);
+    }
+
+    side->journal = true;
+    if (st.st_size > 0) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        side->map = fd < 0 ? MAP_FAILED : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (fd >= 0) close(fd);
+        if (side->map == MAP_FAILED) {
+            side->map = NULL;
+            lerror("Cannot read \"%s\".\n", path);
+            return false;
+        }
+        side->map_len = st.st_size;
+        madvise((void *) side->map, side->map_len, MADV_RANDOM);
+    }
+
+    off_t end;
+    if (!journal_scan(path, diff_journal_visitor, side, &end)) {
+        lerror("Cannot read journal \"%s\".\n", path);
+        return false;
+    }
+    if (side->spill_failed) {
+        lerror("Cannot write temporary partition.\n");
+        return false;
+    }
+    if (end == 0 && st.st_size > 0) {
+        lerror("\"%s\" is neither a dump directory nor a journal.\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void diff_side_close(diff_side *side) {
+    for (uint32_t i = 0; i < FLEET_DIFF_PARTITIONS; i++) {
+        if (side->partitions[i] != NULL) fclose(side->partitions[i]);
+    }
+    if (side->map != NULL) munmap((void *) side->map, side->map_len);
+}
+
+static int compare_entry(const void *a, const void *b) {
+    const diff_entry *x = a, *y = b;
+    if (x->uid != y->uid) return x->uid < y->uid ? -1 : 1;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+/*
+ * Sorted entries of one partition, a UID seen twice keeps its last journal
+ * record. Two files of one UID in a directory keep the first name.
+ */
+static diff_entry *diff_load_partition(FILE *fp, size_t *count) {
+    fflush(fp);
+    long size = ftell(fp);
+    *count = size / sizeof(diff_entry);
+    if (*count == 0) return NULL;
+
+    diff_entry *entries = malloc(*count * sizeof(diff_entry));
+    if (entries == NULL) return NULL;
+    if (pread(fileno(fp), entries, *count * sizeof(diff_entry), 0) != (ssize_t) (*count * sizeof(diff_entry))) {
+        free(entries);
+        return NULL;
+    }
+    qsort(entries, *count, sizeof(diff_entry), compare_entry);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < *count; i++) {
+        if (kept > 0 && entries[kept - 1].uid == entries[i].uid) {
+            if (entries[i].name[0] != '\0') {
+                flockfile(stderr);
+                lwarning("Duplicate dump for UID %016llX, ignoring \"%s\".\n", (unsigned long long) entries[i].uid, entries[i].name);
+                funlockfile(stderr);
+                continue;
+            }
+            kept--;
+        }
+        entries[kept++] = entries[i];
+    }
+    *count = kept;
+    return entries;
+}
+
+// Journal images are used in place, directory dumps are parsed into image
+static const uint8_t *diff_image(const diff_side *side, const diff_entry *entry, uint8_t *image, uint32_t *blocks) {
+    if (side->journal) {
+        *blocks = entry->blocks;
+        return side->map + entry->offset;
+    }
+
+    char path[PATH_MAX];
+    char error[DUMP_ERROR_LEN];
+    dump_info info;
+    snprintf(path, sizeof(path), "%s/%s", side->path, entry->name);
+    if (!dump_load_file(path, DUMP_FORMAT_AUTO, image, &info, error)) {
+        flockfile(stderr);
+        lwarning("Skipped \"%s\": %s.\n", path, error);
+        funlockfile(stderr);
+        return NULL;
+    }
+    *blocks = info.blocks;
+    return image;
+}
+
+/*
+ * Set the bit of every block that differs, returns the number of changed blocks.
+ * Equal images end in one memcmp, otherwise four blocks are compared per step
+ * and only differing steps are split into blocks.
+ */
+static uint32_t diff_blocks(const uint8_t *a, const uint8_t *b, uint32_t blocks, uint8_t *bitmap) {
+    memset(bitmap, 0, SRIX4K_EEPROM_BLOCKS / 8);
+    if (memcmp(a, b, blocks * 4) == 0) return 0;
+
+    uint32_t changed = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= blocks; i += 4) {
+        uint64_t x[2], y[2];
+        memcpy(x, a + i * 4, 16);
+        memcpy(y, b + i * 4, 16);
+        if (((x[0] ^ y[0]) | (x[1] ^ y[1])) == 0) continue;
+
+        for (uint32_t k = i; k < i + 4; k++) {
+            if (memcmp(a + k * 4, b + k * 4, 4) == 0) continue;
+            bitmap[k / 8] |= 1u << (k % 8);
+            changed++;
+        }
+    }
+    for (; i < blocks; i++) {
+        if (memcmp(a + i * 4, b + i * 4, 4) == 0) continue;
+        bitmap[i / 8] |= 1u << (i % 8);
+        changed++;
+    }
+    return changed;
+}
+
+static void diff_flush(diff_job *job, const uint8_t *records, uint32_t count) {
+    if (job->out == NULL || count == 0) return;
+    pthread_mutex_lock(&job->lock);
+    if (fwrite(records, FLEET_DIFF_RECORD_LEN, count, job->out) != count) job->write_failed = true;
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void *diff_worker(void *arg) {
+    diff_job *job = arg;
+    uint64_t block_changes[SRIX4K_EEPROM_BLOCKS] = {};
+    uint64_t both = 0, changed = 0, only_before = 0, only_after = 0, resized = 0, unreadable = 0;
+    uint8_t records[256 * FLEET_DIFF_RECORD_LEN];
+    uint32_t pending = 0;
+    uint8_t before_image[SRIX4K_EEPROM_SIZE], after_image[SRIX4K_EEPROM_SIZE];
+
+    uint32_t p;
+    while ((p = __atomic_fetch_add(&job->next_partition, 1, __ATOMIC_RELAXED)) < FLEET_DIFF_PARTITIONS) {
+        size_t before_count, after_count;
+        diff_entry *before = diff_load_partition(job->before->partitions[p], &before_count);
+        diff_entry *after = diff_load_partition(job->after->partitions[p], &after_count);
+        if ((before == NULL && before_count > 0) || (after == NULL && after_count > 0)) {
+            lerror("Cannot read temporary partition.\n");
+            pthread_mutex_lock(&job->lock);
+            job->write_failed = true;
+            pthread_mutex_unlock(&job->lock);
+            free(before);
+            free(after);
+            continue;
+        }
+
+        // Merge join on sorted UIDs
+        size_t i = 0, j = 0;
+        while (i < before_count || j < after_count) {
+            if (j == after_count || (i < before_count && before[i].uid < after[j].uid)) {
+                only_before++;
+                i++;
+                continue;
+            }
+            if (i == before_count || after[j].uid < before[i].uid) {
+                only_after++;
+                j++;
+                continue;
+            }
+
+            both++;
+            uint32_t before_blocks, after_blocks;
+            const uint8_t *a = diff_image(job->before, &before[i], before_image, &before_blocks);
+            const uint8_t *b = diff_image(job->after, &after[j], after_image, &after_blocks);
+            uint64_t uid = before[i].uid;
+            i++;
+            j++;
+
+            if (a == NULL || b == NULL) {
+                unreadable++;
+                continue;
+            }
+            if (before_blocks != after_blocks) {
+                resized++;
+                continue;
+            }
+
+            uint8_t *record = records + pending * FLEET_DIFF_RECORD_LEN;
+            if (diff_blocks(a, b, before_blocks, record + 8) == 0) continue;
+
+            changed++;
+            for (uint32_t k = 0; k < before_blocks; k++) {
+                if ((record[8 + k / 8] >> (k % 8)) & 1u) block_changes[k]++;
+            }
+            for (int k = 0; k < 8; k++) {
+                record[k] = uid >> (8 * k);
+            }
+            if (++pending == sizeof(records) / FLEET_DIFF_RECORD_LEN) {
+                diff_flush(job, records, pending);
+                pending = 0;
+            }
+        }
+        free(before);
+        free(after);
+    }
+    diff_flush(job, records, pending);
+
+    pthread_mutex_lock(&job->lock);
+    for (uint32_t k = 0; k < SRIX4K_EEPROM_BLOCKS; k++) {
+        job->block_changes[k] += block_changes[k];
+    }
+    job->both += both;
+    job->changed += changed;
+    job->only_before += only_before;
+    job->only_after += only_after;
+    job->resized += resized;
+    job->unreadable += unreadable;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static bool diff_write_header(FILE *fp, uint64_t changed) {
+    uint8_t header[FLEET_DIFF_HEADER_LEN] = {};
+    for (int k = 0; k < 4; k++) header[k] = FLEET_DIFF_MAGIC >> (8 * k);
+    header[4] = 1;
+    header[6] = FLEET_DIFF_RECORD_LEN;
+    for (int k = 0; k < 8; k++) header[8 + k] = changed >> (8 * k);
+    return fseek(fp, 0, SEEK_SET) == 0 && fwrite(header, sizeof(header), 1, fp) == 1;
+}
+
+static void diff_print(const diff_job *job, double elapsed_ms, int workers) {
+    printf("%" PRIu64 " tags before, %" PRIu64 " after, %" PRIu64 " in both: %" PRIu64 " changed, %" PRIu64 " unchanged\n",
+           job->both + job->only_before, job->both + job->only_after, job->both, job->changed, job->both - job->changed - job->resized - job->unreadable);
+    if (job->only_before > 0 || job->only_after > 0) {
+        printf("%" PRIu64 " tags only before, %" PRIu64 " only after\n", job->only_before, job->only_after);
+    }
+    if (job->resized > 0 || job->unreadable > 0) {
+        lwarning("%" PRIu64 " tags changed size, %" PRIu64 " could not be read.\n", job->resized, job->unreadable);
+    }
+
+    for (uint32_t k = 0; k < SRIX4K_EEPROM_BLOCKS; k++) {
+        if (job->block_changes[k] == 0) continue;
+        printf("[%02X] %10" PRIu64 " tags %6.2f%%" DIM " --- %s" RESET "\n", k, job->block_changes[k],
+               100.0 * job->block_changes[k] / job->both, srix_get_block_type(k));
+    }
+    printf("Compared %" PRIu64 " tags in %.2f ms on %d threads (%.0f tags/s)\n", job->both, elapsed_ms, workers,
+           elapsed_ms > 0 ? job->both * 1000.0 / elapsed_ms : 0);
+}
+
+/*
+ * Join before and after by UID and compare every tag found in both.
+ * Per-block change counts are printed, changed tags go to bitmap_path if not NULL.
+ */
+bool fleet_diff(const char *before_path, const char *after_path, const char *bitmap_path) {
+    double start = monotonic_ms();
+    diff_side *before = calloc(1, sizeof(diff_side));
+    diff_side *after = calloc(1, sizeof(diff_side));
+    diff_job *job = calloc(1, sizeof(diff_job));
+    bool ok = before != NULL && after != NULL && job != NULL;
+
+    ok = ok && diff_side_open(before, before_path) && diff_side_open(after, after_path);
+    if (ok && bitmap_path != NULL) {
+        job->out = fopen(bitmap_path, "wb");
+        if (job->out == NULL || !diff_write_header(job->out, 0)) {
+            lerror("Cannot write \"%s\".\n", bitmap_path);
+            ok = false;
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int) cpus : 1;
+    if (ok) {
+        job->before = before;
+        job->after = after;
+        pthread_mutex_init(&job->lock, NULL);
+
+        pthread_t threads[workers];
+        int started = 0;
+        while (started < workers && pthread_create(&threads[started], NULL, diff_worker, job) == 0) {
+            started++;
+        }
+        if (started == 0) {
+            diff_worker(job);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&job->lock);
+        workers = started > 0 ? started : 1;
+
+        if (job->out != NULL && !diff_write_header(job->out, job->changed)) job->write_failed = true;
+        if (job->write_failed) {
+            lerror("Cannot write \"%s\".\n", bitmap_path != NULL ? bitmap_path : "temporary partition");
+            ok = false;
+        }
+        diff_print(job, monotonic_ms() - start, workers);
+    }
+
+    if (job != NULL && job->out != NULL && fclose(job->out) != 0) {
+        lerror("Cannot write \"%s\".\n", bitmap_path);
+        ok = false;
+    }
+    if (before != NULL) diff_side_close(before);
+    if (after != NULL) diff_side_close(after);
+    free(before);
+    free(after);
+    free(job);
+    return ok;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_FLEET_DIFF_H__
+#define __NFC_SRIX_FLEET_DIFF_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Macros */
+#define FLEET_DIFF_PARTITIONS 128           // UID hash partitions, one in memory per worker
+#define FLEET_DIFF_NAME_LEN 48              // longest <UID> file name in a directory
+#define FLEET_DIFF_MAGIC 0x44585253u        // "SRXD"
+#define FLEET_DIFF_HEADER_LEN 16
+#define FLEET_DIFF_RECORD_LEN 24
+
+/*
+ * Changed-block bitmap file, little endian.
+ * Header: magic u32, version u16, record length u16, changed tags u64.
+ * Record per changed tag: UID u64 (as in file names), bitmap of 128 blocks,
+ * block N is bit N % 8 of byte N / 8.
+ */
+
+bool fleet_diff(const char *before, const char *after, const char *bitmap_path);
+
+#endif // __NFC_SRIX_FLEET_DIFF_H__
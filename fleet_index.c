@@ -0,0 +1,164 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "logging.h"
+#include "fleet_index.h"
+
+// GET_UID response (LSB first) to the value printed by read_tag_info
+uint64_t srix_uid_to_u64(const uint8_t *uid) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = value << 8u | uid[i];
+    }
+    return value;
+}
+
+// Accepts names starting with 16 hex digits, e.g. "D002...2211.bin"
+bool parse_uid_name(const char *name, uint64_t *uid) {
+    uint64_t value = 0;
+    for (int i = 0; i < 16; i++) {
+        if (!isxdigit((unsigned char) name[i])) return false;
+        value = value << 4u | (uint64_t) (isdigit((unsigned char) name[i]) ? name[i] - '0' : (toupper((unsigned char) name[i]) - 'A' + 10));
+    }
+    if (isxdigit((unsigned char) name[16])) return false;
+
+    *uid = value;
+    return true;
+}
+
+static size_t fleet_slot(const fleet_index *index, uint64_t uid) {
+    // Fibonacci hashing, capacity is a power of two
+    return (size_t) ((uid * 0x9E3779B97F4A7C15ull) >> 32u) & (index->capacity - 1);
+}
+
+static void fleet_clear(fleet_index *index) {
+    for (size_t i = 0; i < index->capacity; i++) {
+        free(index->entries[i].path);
+    }
+    free(index->entries);
+    index->entries = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
+static bool fleet_insert(fleet_index *index, uint64_t uid, const char *path) {
+    size_t slot = fleet_slot(index, uid);
+    while (index->entries[slot].path != NULL) {
+        if (index->entries[slot].uid == uid) {
+            lwarning("Duplicate dump for UID %016llX, ignoring \"%s\".\n", (unsigned long long) uid, path);
+            return true;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+
+    index->entries[slot].uid = uid;
+    index->entries[slot].path = strdup(path);
+    if (index->entries[slot].path == NULL) return false;
+    index->count++;
+    return true;
+}
+
+static bool fleet_scan(fleet_index *index) {
+    DIR *dir = opendir(index->dir);
+    if (dir == NULL) {
+        lerror("Cannot open \"%s\".\n", index->dir);
+        return false;
+    }
+
+    struct stat dir_stat;
+    bool has_mtime = fstat(dirfd(dir), &dir_stat) == 0;
+
+    // Size the table for a load factor of at most 1/2
+    size_t files = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) files++;
+
+    // Keep the old table if the new one cannot be allocated
+    size_t capacity = 16;
+    while (capacity < files * 2) capacity <<= 1u;
+    fleet_entry *entries = calloc(capacity, sizeof(fleet_entry));
+    if (entries == NULL) {
+        closedir(dir);
+        return false;
+    }
+
+    fleet_clear(index);
+    index->entries = entries;
+    index->capacity = capacity;
+    if (has_mtime) {
+        index->mtime = dir_stat.st_mtim;
+    }
+
+    rewinddir(dir);
+    char path[4096];
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t uid;
+        if (!parse_uid_name(entry->d_name, &uid)) continue;
+
+        snprintf(path, sizeof(path), "%s/%s", index->dir, entry->d_name);
+        if (!fleet_insert(index, uid, path)) {
+            closedir(dir);
+            return false;
+        }
+    }
+    closedir(dir);
+
+    lverbose("Indexed %zu dumps in \"%s\".\n", index->count, index->dir);
+    return true;
+}
+
+bool fleet_index_load(fleet_index *index, const char *dir) {
+    memset(index, 0, sizeof(*index));
+    index->dir = strdup(dir);
+    if (index->dir == NULL) return false;
+    return fleet_scan(index);
+}
+
+/*
+ * Path of the dump for uid, or NULL.
+ * On a miss the directory is rescanned if it changed since the last scan.
+ */
+const char *fleet_index_find(fleet_index *index, uint64_t uid) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (index->capacity > 0) {
+            size_t slot = fleet_slot(index, uid);
+            while (index->entries[slot].path != NULL) {
+                if (index->entries[slot].uid == uid) return index->entries[slot].path;
+                slot = (slot + 1) & (index->capacity - 1);
+            }
+        }
+
+        struct stat dir_stat;
+        if (attempt > 0 || stat(index->dir, &dir_stat) < 0) break;
+        if (dir_stat.st_mtim.tv_sec == index->mtime.tv_sec && dir_stat.st_mtim.tv_nsec == index->mtime.tv_nsec) break;
+        if (!fleet_scan(index)) break;
+    }
+    return NULL;
+}
+
+void fleet_index_free(fleet_index *index) {
+    fleet_clear(index);
+    free(index->dir);
+    index->dir = NULL;
+}
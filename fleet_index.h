@@ -0,0 +1,46 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_FLEET_INDEX_H__
+#define __NFC_SRIX_FLEET_INDEX_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Dumps are stored as <UID>.bin, UID as printed by read_tag_info */
+typedef struct {
+    uint64_t uid;
+    char *path;
+} fleet_entry;
+
+typedef struct {
+    char *dir;
+    fleet_entry *entries;
+    size_t capacity;          // power of two
+    size_t count;
+    struct timespec mtime;    // directory mtime at the last scan
+} fleet_index;
+
+uint64_t srix_uid_to_u64(const uint8_t *uid);
+bool parse_uid_name(const char *name, uint64_t *uid);
+
+bool fleet_index_load(fleet_index *index, const char *dir);
+const char *fleet_index_find(fleet_index *index, uint64_t uid);
+void fleet_index_free(fleet_index *index);
+
+#endif // __NFC_SRIX_FLEET_INDEX_H__
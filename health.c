@@ -0,0 +1,226 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "transport.h"
+#include "health.h"
+
+/*
+ * Reader health.
+ * Every frame lands in a per-reader window of HEALTH_WINDOW frames. A reader
+ * whose error or retry rate crosses its limit is quarantined: callers stop
+ * giving it work and probe it once HEALTH_PROBE_MS has passed, doubling the
+ * wait after each failed probe.
+ */
+
+static reader_health health_table[MAX_DEVICE_COUNT + 1];
+static uint32_t health_count = 0;
+static pthread_mutex_t health_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Entry for key, created on first use, NULL once the table is full
+reader_health *health_find(const char *key) {
+    if (key == NULL) return NULL;
+
+    pthread_mutex_lock(&health_lock);
+    reader_health *health = NULL;
+    for (uint32_t i = 0; i < health_count; i++) {
+        if (strcmp(health_table[i].key, key) == 0) {
+            health = &health_table[i];
+            break;
+        }
+    }
+    if (health == NULL && health_count < sizeof(health_table) / sizeof(health_table[0])) {
+        health = &health_table[health_count++];
+        strncpy(health->key, key, sizeof(health->key) - 1);
+    }
+    pthread_mutex_unlock(&health_lock);
+    return health;
+}
+
+// Frames without an nfc_device go through the active transport
+reader_health *health_for_device(nfc_device *reader) {
+    if (reader == NULL) {
+        return active_transport != NULL ? health_find(active_transport->name) : NULL;
+    }
+    return health_find(nfc_device_get_connstring(reader));
+}
+
+// Lock held
+static double health_rate(const reader_health *health, uint8_t flag) {
+    if (health->count == 0) return 0;
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < health->count; i++) {
+        if (health->flags[i] & flag) hits++;
+    }
+    return (double) hits / health->count;
+}
+
+static int compare_float(const void *a, const void *b) {
+    float x = *(const float *) a, y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+// Lock held
+static double health_median(const reader_health *health) {
+    if (health->count == 0) return 0;
+    float sorted[HEALTH_WINDOW];
+    memcpy(sorted, health->latency_ms, health->count * sizeof(float));
+    qsort(sorted, health->count, sizeof(float), compare_float);
+    return sorted[health->count / 2];
+}
+
+void health_record(reader_health *health, bool ok, double latency_ms) {
+    if (health == NULL) return;
+
+    pthread_mutex_lock(&health_lock);
+    health->latency_ms[health->next] = latency_ms;
+    health->flags[health->next] = ok ? 0 : HEALTH_FRAME_ERROR;
+    health->next = (health->next + 1) % HEALTH_WINDOW;
+    if (health->count < HEALTH_WINDOW) health->count++;
+    health->frames++;
+    if (!ok) health->errors++;
+
+    if (!health->quarantined && health->count >= HEALTH_MIN_FRAMES) {
+        double error_rate = health_rate(health, HEALTH_FRAME_ERROR);
+        double retry_rate = health_rate(health, HEALTH_FRAME_RETRY);
+        if (error_rate > HEALTH_MAX_ERROR_RATE || retry_rate > HEALTH_MAX_RETRY_RATE) {
+            health->quarantined = true;
+            health->quarantines++;
+            health->probe_backoff_ms = HEALTH_PROBE_MS;
+            health->probe_at_ms = monotonic_ms() + HEALTH_PROBE_MS;
+            lwarning("Reader %s quarantined: %.0f%% errors, %.0f%% retries, median %.2f ms.\n",
+                     health->key, error_rate * 100, retry_rate * 100, health_median(health));
+        }
+    }
+    pthread_mutex_unlock(&health_lock);
+}
+
+// The last recorded frame is being sent again
+void health_mark_retry(reader_health *health) {
+    if (health == NULL) return;
+
+    pthread_mutex_lock(&health_lock);
+    if (health->count > 0) {
+        health->flags[(health->next + HEALTH_WINDOW - 1) % HEALTH_WINDOW] |= HEALTH_FRAME_RETRY;
+        health->retries++;
+    }
+    pthread_mutex_unlock(&health_lock);
+}
+
+double health_error_rate(reader_health *health) {
+    pthread_mutex_lock(&health_lock);
+    double rate = health_rate(health, HEALTH_FRAME_ERROR);
+    pthread_mutex_unlock(&health_lock);
+    return rate;
+}
+
+double health_retry_rate(reader_health *health) {
+    pthread_mutex_lock(&health_lock);
+    double rate = health_rate(health, HEALTH_FRAME_RETRY);
+    pthread_mutex_unlock(&health_lock);
+    return rate;
+}
+
+double health_median_ms(reader_health *health) {
+    pthread_mutex_lock(&health_lock);
+    double median = health_median(health);
+    pthread_mutex_unlock(&health_lock);
+    return median;
+}
+
+// 1 for a clean, fast reader, towards 0 as errors, retries and latency grow
+double health_score(reader_health *health) {
+    if (health == NULL) return 1;
+
+    pthread_mutex_lock(&health_lock);
+    double score = (1 - health_rate(health, HEALTH_FRAME_ERROR)) * (1 - health_rate(health, HEALTH_FRAME_RETRY))
+                   * HEALTH_LATENCY_REF_MS / (HEALTH_LATENCY_REF_MS + health_median(health));
+    pthread_mutex_unlock(&health_lock);
+    return score;
+}
+
+health_state health_check(reader_health *health) {
+    if (health == NULL) return HEALTH_OK;
+
+    pthread_mutex_lock(&health_lock);
+    health_state state = HEALTH_OK;
+    if (health->quarantined) {
+        state = monotonic_ms() >= health->probe_at_ms ? HEALTH_PROBE_DUE : HEALTH_QUARANTINED;
+    }
+    pthread_mutex_unlock(&health_lock);
+    return state;
+}
+
+// A good probe re-admits with an empty window, a bad one doubles the wait
+void health_probe_done(reader_health *health, bool ok) {
+    if (health == NULL) return;
+
+    pthread_mutex_lock(&health_lock);
+    if (ok) {
+        health->quarantined = false;
+        health->count = 0;
+        health->next = 0;
+        printf("Reader %s " GREEN "re-admitted" RESET ".\n", health->key);
+    } else {
+        health->probe_backoff_ms *= 2;
+        if (health->probe_backoff_ms > HEALTH_PROBE_MAX_MS) health->probe_backoff_ms = HEALTH_PROBE_MAX_MS;
+        health->probe_at_ms = monotonic_ms() + health->probe_backoff_ms;
+        lverbose("Reader %s failed its probe, next in %.0f s.\n", health->key, health->probe_backoff_ms / 1000);
+    }
+    pthread_mutex_unlock(&health_lock);
+}
+
+// Healthiest reader of connstrings, quarantined readers only when all are
+size_t health_pick(const nfc_connstring *connstrings, size_t count) {
+    size_t best = 0;
+    double best_score = -1;
+    for (size_t i = 0; i < count; i++) {
+        reader_health *health = health_find(connstrings[i]);
+        double score = health_score(health);
+        if (health_check(health) != HEALTH_OK) score -= 1;
+        if (score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+void health_print(void) {
+    pthread_mutex_lock(&health_lock);
+    uint32_t count = health_count;
+    pthread_mutex_unlock(&health_lock);
+
+    for (uint32_t i = 0; i < count; i++) {
+        reader_health *health = &health_table[i];
+        if (health->frames == 0) continue;
+
+        printf("%s: score %.2f, %.1f%% errors, %.1f%% retries, median %.2f ms, %" PRIu64 " frames",
+               health->key, health_score(health), health_error_rate(health) * 100, health_retry_rate(health) * 100,
+               health_median_ms(health), health->frames);
+        if (health->quarantines > 0) printf(", %u quarantines", health->quarantines);
+        printf("%s\n", health->quarantined ? RED ", quarantined" RESET : "");
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_HEALTH_H__
+#define __NFC_SRIX_HEALTH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <nfc/nfc.h>
+
+/* Macros */
+#define HEALTH_WINDOW 64                    // frames in the rolling window
+#define HEALTH_MIN_FRAMES 16                // before a reader can be quarantined
+#define HEALTH_MAX_ERROR_RATE 0.25
+#define HEALTH_MAX_RETRY_RATE 0.25
+#define HEALTH_LATENCY_REF_MS 10.0          // median latency that halves the score
+#define HEALTH_PROBE_MS 5000                // quarantine before the first probe
+#define HEALTH_PROBE_MAX_MS 60000           // doubles per failed probe up to this
+#define HEALTH_PROBE_POLL_MS 500            // how often parked readers are looked at
+
+#define HEALTH_FRAME_ERROR 1u
+#define HEALTH_FRAME_RETRY 2u
+
+typedef enum {
+    HEALTH_OK,
+    HEALTH_QUARANTINED,
+    HEALTH_PROBE_DUE,
+} health_state;
+
+/*
+ * Rolling health of one reader, keyed by connstring (transport name for
+ * transports). Updated from any thread.
+ */
+typedef struct {
+    char key[sizeof(nfc_connstring)];
+    float latency_ms[HEALTH_WINDOW];
+    uint8_t flags[HEALTH_WINDOW];
+    uint32_t next;                      // ring position
+    uint32_t count;                     // frames in the window
+
+    uint64_t frames;                    // lifetime
+    uint64_t errors;
+    uint64_t retries;
+
+    bool quarantined;
+    double probe_at_ms;
+    double probe_backoff_ms;
+    uint32_t quarantines;
+} reader_health;
+
+reader_health *health_find(const char *key);
+reader_health *health_for_device(nfc_device *reader);
+
+void health_record(reader_health *health, bool ok, double latency_ms);
+void health_mark_retry(reader_health *health);
+
+double health_error_rate(reader_health *health);
+double health_retry_rate(reader_health *health);
+double health_median_ms(reader_health *health);
+double health_score(reader_health *health);
+
+health_state health_check(reader_health *health);
+void health_probe_done(reader_health *health, bool ok);
+
+size_t health_pick(const nfc_connstring *connstrings, size_t count);
+void health_print(void);
+
+#endif // __NFC_SRIX_HEALTH_H__
@@ -0,0 +1,464 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE // syncfs
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "dump.h"
+#include "journal.h"
+#include "trace.h"
+
+/*
+ * Group commit for read stations.
+ * Completed dumps are appended to a pending batch in memory; one writer thread
+ * turns each batch into a single pwrite and a single fdatasync once it holds
+ * journal_commit_count records or its oldest record is journal_commit_ms old.
+ * While a commit is in flight the next batch keeps filling, so batches grow
+ * when the disk is slow and appends only block once a whole batch is waiting.
+ */
+
+uint32_t journal_commit_count = JOURNAL_DEFAULT_COMMIT_COUNT;
+uint32_t journal_commit_ms = JOURNAL_DEFAULT_COMMIT_MS;
+
+// N[:MS], commit every N dumps or MS milliseconds
+bool parse_journal_commit(const char *spec) {
+    char *end;
+    unsigned long count = strtoul(spec, &end, 10);
+    if (end == spec || count == 0 || count > JOURNAL_BATCH_MAX) {
+        return false;
+    }
+
+    unsigned long ms = journal_commit_ms;
+    if (*end == ':') {
+        const char *ms_spec = end + 1;
+        ms = strtoul(ms_spec, &end, 10);
+        if (end == ms_spec || ms > 60000) {
+            return false;
+        }
+    }
+    if (*end != '\0') {
+        return false;
+    }
+
+    journal_commit_count = count;
+    journal_commit_ms = ms;
+    return true;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1u) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static void put_le(uint8_t *dst, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        dst[i] = value >> (8u * i);
+    }
+}
+
+static uint64_t get_le(const uint8_t *src, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = value << 8u | src[i];
+    }
+    return value;
+}
+
+static uint64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000u + ts.tv_nsec / 1000000u;
+}
+
+static size_t journal_record(uint8_t *record, const uint8_t *uid, const uint8_t *image, uint32_t blocks) {
+    size_t image_len = blocks * 4;
+
+    memset(record, 0, JOURNAL_HEADER_LEN);
+    put_le(record, JOURNAL_MAGIC, 4);
+    put_le(record + 4, blocks, 2);
+    memcpy(record + 8, uid, 8);
+    put_le(record + 16, wall_clock_ms(), 8);
+    memcpy(record + JOURNAL_HEADER_LEN, image, image_len);
+
+    uint32_t crc = crc32_update(0, record, JOURNAL_HEADER_LEN + image_len);
+    put_le(record + 24, crc, 4);
+    return JOURNAL_HEADER_LEN + image_len;
+}
+
+// Walk valid records from the start, stops at the first torn or blank one
+bool journal_scan(const char *path, journal_visitor visitor, void *data, off_t *end) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        if (end != NULL) *end = 0;
+        return true;
+    }
+
+    const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    off_t offset = 0;
+    bool keep_going = true;
+    while (keep_going && offset + JOURNAL_HEADER_LEN <= st.st_size) {
+        const uint8_t *record = map + offset;
+        uint32_t blocks = get_le(record + 4, 2);
+        size_t len = JOURNAL_HEADER_LEN + blocks * 4;
+
+        if (get_le(record, 4) != JOURNAL_MAGIC || blocks == 0 || len > JOURNAL_RECORD_MAX || offset + (off_t) len > st.st_size) {
+            break;
+        }
+
+        uint8_t header[JOURNAL_HEADER_LEN];
+        memcpy(header, record, JOURNAL_HEADER_LEN);
+        put_le(header + 24, 0, 4);
+        uint32_t crc = crc32_update(crc32_update(0, header, JOURNAL_HEADER_LEN), record + JOURNAL_HEADER_LEN, blocks * 4);
+        if (crc != get_le(record + 24, 4)) {
+            break;
+        }
+
+        if (visitor != NULL) {
+            keep_going = visitor(data, record + 8, get_le(record + 16, 8), record + JOURNAL_HEADER_LEN, blocks);
+        }
+        offset += len;
+    }
+
+    munmap((void *) map, st.st_size);
+    if (end != NULL) *end = offset;
+    return true;
+}
+
+// Zero-fill ahead of the write position, the new extent is synced with its metadata once
+static bool journal_reserve(srix_journal *journal, size_t len) {
+    static const uint8_t zeros[4096];
+
+    if (journal->offset + (off_t) len <= journal->allocated) {
+        return true;
+    }
+
+    off_t target = journal->allocated + JOURNAL_EXTENT;
+    while (target < journal->offset + (off_t) len) target += JOURNAL_EXTENT;
+
+    for (off_t pos = journal->allocated; pos < target; pos += sizeof(zeros)) {
+        if (pwrite(journal->fd, zeros, sizeof(zeros), pos) != (ssize_t) sizeof(zeros)) {
+            return false;
+        }
+    }
+    if (fsync(journal->fd) != 0) {
+        return false;
+    }
+    journal->allocated = target;
+    return true;
+}
+
+static bool journal_commit(srix_journal *journal, const journal_batch *batch) {
+    if (!journal_reserve(journal, batch->len)) {
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < batch->len) {
+        ssize_t ret = pwrite(journal->fd, batch->data + done, batch->len - done, journal->offset + done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+        done += ret;
+    }
+    if (fdatasync(journal->fd) != 0) {
+        return false;
+    }
+
+    journal->offset += batch->len;
+    return true;
+}
+
+static void *journal_writer(void *arg) {
+    srix_journal *journal = arg;
+
+    pthread_mutex_lock(&journal->lock);
+    while (true) {
+        while (journal->pending->count == 0 && !journal->closing) {
+            pthread_cond_wait(&journal->ready, &journal->lock);
+        }
+        if (journal->pending->count == 0) {
+            break;
+        }
+
+        // Commit window: enough records, or the oldest one waited long enough
+        while (journal->pending->count < journal_commit_count && !journal->closing) {
+            double deadline = journal->pending_since + journal_commit_ms;
+            double now = monotonic_ms();
+            if (now >= deadline) break;
+
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            long wait_ns = (long) ((deadline - now) * 1000000.0);
+            ts.tv_sec += wait_ns / 1000000000L;
+            ts.tv_nsec += wait_ns % 1000000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&journal->ready, &journal->lock, &ts);
+        }
+
+        // Swap batches, appends go on while this one is written
+        journal_batch *batch = journal->pending;
+        journal->pending = batch == &journal->batches[0] ? &journal->batches[1] : &journal->batches[0];
+        journal->pending->len = 0;
+        journal->pending->count = 0;
+        uint64_t seq = journal->appended_seq;
+        pthread_cond_broadcast(&journal->space);
+        pthread_mutex_unlock(&journal->lock);
+
+        double start = monotonic_ms();
+        TRACE2(journal_commit_start, batch->count, batch->len);
+        bool committed = journal_commit(journal, batch);
+        TRACE2(journal_commit_done, batch->count, committed);
+        double elapsed = monotonic_ms() - start;
+
+        if (committed && journal->ack != NULL) {
+            for (uint32_t i = 0; i < batch->count; i++) {
+                journal->ack(journal->ack_data, batch->uids[i], seq - batch->count + i + 1);
+            }
+        }
+
+        pthread_mutex_lock(&journal->lock);
+        if (!committed) {
+            lerror("Journal write failed: %s\n", strerror(errno));
+            journal->failed = true;
+            pthread_cond_broadcast(&journal->space);
+            pthread_cond_broadcast(&journal->durable);
+            break;
+        }
+        journal->durable_seq = seq;
+        journal->commits++;
+        journal->records += batch->count;
+        journal->commit_ms_total += elapsed;
+        if (elapsed > journal->commit_ms_max) journal->commit_ms_max = elapsed;
+        pthread_cond_broadcast(&journal->durable);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    return NULL;
+}
+
+/*
+ * Open or create a journal, new records go after the last valid one.
+ * ack is called from the writer thread once a record is on disk.
+ */
+bool journal_open(srix_journal *journal, const char *path, journal_ack ack, void *ack_data) {
+    memset(journal, 0, sizeof(srix_journal));
+
+    // A new journal is only durable once its directory entry is
+    bool created = true;
+    journal->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (journal->fd < 0 && errno == EEXIST) {
+        created = false;
+        journal->fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+    struct stat st;
+    if (journal->fd < 0 || fstat(journal->fd, &st) < 0 || (created && !sync_parent_dir(path))) {
+        lerror("Cannot open journal \"%s\".\n", path);
+        if (journal->fd >= 0) close(journal->fd);
+        return false;
+    }
+    if (!journal_scan(path, NULL, NULL, &journal->offset)) {
+        lerror("Cannot read journal \"%s\".\n", path);
+        close(journal->fd);
+        return false;
+    }
+    journal->allocated = st.st_size;
+
+    for (int i = 0; i < 2; i++) {
+        journal->batches[i].data = malloc(JOURNAL_BATCH_MAX * JOURNAL_RECORD_MAX);
+        if (journal->batches[i].data == NULL) {
+            free(journal->batches[0].data);
+            close(journal->fd);
+            return false;
+        }
+    }
+    journal->pending = &journal->batches[0];
+    journal->ack = ack;
+    journal->ack_data = ack_data;
+
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->ready, NULL);
+    pthread_cond_init(&journal->space, NULL);
+    pthread_cond_init(&journal->durable, NULL);
+    if (pthread_create(&journal->writer, NULL, journal_writer, journal) != 0) {
+        lerror("Cannot start journal writer.\n");
+        free(journal->batches[0].data);
+        free(journal->batches[1].data);
+        close(journal->fd);
+        return false;
+    }
+
+    lverbose("Journal \"%s\": %lld bytes of records.\n", path, (long long) journal->offset);
+    return true;
+}
+
+// Queue one dump, returns its sequence number or 0 once the journal failed
+uint64_t journal_append(srix_journal *journal, const uint8_t *uid, const uint8_t *image, uint32_t blocks) {
+    pthread_mutex_lock(&journal->lock);
+
+    // Backpressure: a full batch is waiting behind the one being written
+    if (journal->pending->count == JOURNAL_BATCH_MAX && !journal->failed) {
+        journal->stalls++;
+        while (journal->pending->count == JOURNAL_BATCH_MAX && !journal->failed) {
+            pthread_cond_wait(&journal->space, &journal->lock);
+        }
+    }
+    if (journal->failed) {
+        pthread_mutex_unlock(&journal->lock);
+        return 0;
+    }
+
+    journal_batch *batch = journal->pending;
+    if (batch->count == 0) {
+        journal->pending_since = monotonic_ms();
+    }
+    batch->len += journal_record(batch->data + batch->len, uid, image, blocks);
+    memcpy(batch->uids[batch->count], uid, 8);
+    batch->count++;
+    uint64_t seq = ++journal->appended_seq;
+
+    pthread_cond_signal(&journal->ready);
+    pthread_mutex_unlock(&journal->lock);
+    return seq;
+}
+
+// Block until record seq is on disk
+bool journal_wait(srix_journal *journal, uint64_t seq) {
+    pthread_mutex_lock(&journal->lock);
+    while (journal->durable_seq < seq && !journal->failed) {
+        pthread_cond_wait(&journal->durable, &journal->lock);
+    }
+    bool durable = journal->durable_seq >= seq;
+    pthread_mutex_unlock(&journal->lock);
+    return durable;
+}
+
+// Commit what is pending and stop the writer
+bool journal_close(srix_journal *journal) {
+    pthread_mutex_lock(&journal->lock);
+    journal->closing = true;
+    pthread_cond_signal(&journal->ready);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->writer, NULL);
+
+    bool ok = !journal->failed && journal->durable_seq == journal->appended_seq;
+
+    pthread_mutex_destroy(&journal->lock);
+    pthread_cond_destroy(&journal->ready);
+    pthread_cond_destroy(&journal->space);
+    pthread_cond_destroy(&journal->durable);
+    free(journal->batches[0].data);
+    free(journal->batches[1].data);
+    close(journal->fd);
+    return ok;
+}
+
+void journal_print_stats(const srix_journal *journal, double elapsed_ms) {
+    printf("Saved %llu dumps in %llu commits", (unsigned long long) journal->records, (unsigned long long) journal->commits);
+    if (journal->commits > 0) {
+        printf(", commit latency avg %.2f ms max %.2f ms", journal->commit_ms_total / journal->commits, journal->commit_ms_max);
+    }
+    if (elapsed_ms > 0) {
+        printf(", %.1f dumps/s", journal->records * 1000.0 / elapsed_ms);
+    }
+    if (journal->stalls > 0) {
+        printf(", %llu stalls on disk", (unsigned long long) journal->stalls);
+    }
+    printf("\n");
+}
+
+typedef struct {
+    const char *dir;
+    uint32_t exported;
+    bool failed;
+} journal_export_state;
+
+static bool export_record(void *data, const uint8_t *uid, uint64_t time_ms, const uint8_t *image, uint32_t blocks) {
+    journal_export_state *state = data;
+
+    char uid_str[17];
+    char path[PATH_MAX];
+    srix_uid_to_string(uid, uid_str);
+    snprintf(path, sizeof(path), "%s/%s.bin", state->dir, uid_str);
+
+    // Later records of the same tag replace earlier ones
+    dump_info info = {.blocks = blocks, .has_uid = true};
+    memcpy(info.uid, uid, sizeof(info.uid));
+    if (!dump_save(path, image, &info, DUMP_FORMAT_RAW)) {
+        lerror("Cannot write \"%s\".\n", path);
+        state->failed = true;
+        return false;
+    }
+    state->exported++;
+    return true;
+}
+
+// Write the latest dump of every tag to DIR/<UID>.bin, synced once at the end
+bool journal_export(const char *path, const char *dir) {
+    journal_export_state state = {.dir = dir};
+
+    if (!journal_scan(path, export_record, &state, NULL)) {
+        lerror("Cannot read journal \"%s\".\n", path);
+        return false;
+    }
+
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0 || syncfs(dir_fd) != 0) {
+        lerror("Cannot sync \"%s\".\n", dir);
+        if (dir_fd >= 0) close(dir_fd);
+        return false;
+    }
+    close(dir_fd);
+
+    printf("Exported %u records to \"%s\".\n", state.exported, dir);
+    return !state.failed;
+}
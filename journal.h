@@ -0,0 +1,97 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_JOURNAL_H__
+#define __NFC_SRIX_JOURNAL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* Macros */
+#define JOURNAL_MAGIC 0x4A585253u             // "SRXJ"
+#define JOURNAL_HEADER_LEN 32
+#define JOURNAL_RECORD_MAX (JOURNAL_HEADER_LEN + 512)
+#define JOURNAL_BATCH_MAX 256                 // records held while a commit is in flight
+#define JOURNAL_EXTENT (1024 * 1024)          // zero-filled ahead so fdatasync skips metadata
+#define JOURNAL_DEFAULT_COMMIT_COUNT 32
+#define JOURNAL_DEFAULT_COMMIT_MS 20
+
+/*
+ * Record layout, little endian:
+ * magic u32, blocks u16, flags u16, uid[8] (GET_UID order), time_ms u64,
+ * crc32 u32 over header (crc zeroed) and image, reserved u32, image.
+ */
+
+typedef void (*journal_ack)(void *data, const uint8_t *uid, uint64_t seq);
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    uint32_t count;
+    uint8_t uids[JOURNAL_BATCH_MAX][8];
+} journal_batch;
+
+typedef struct {
+    int fd;
+    off_t offset;             // end of the last record
+    off_t allocated;          // zero-filled file size
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;     // records pending or closing
+    pthread_cond_t space;     // pending batch drained
+    pthread_cond_t durable;   // durable_seq advanced
+    pthread_t writer;
+
+    journal_batch batches[2];
+    journal_batch *pending;   // filled by journal_append
+    double pending_since;     // first pending record, ms
+    uint64_t appended_seq;
+    uint64_t durable_seq;
+    bool closing;
+    bool failed;
+
+    journal_ack ack;
+    void *ack_data;
+
+    // Statistics
+    uint64_t commits;
+    uint64_t records;
+    uint64_t stalls;          // appends that waited for the disk
+    double commit_ms_total;
+    double commit_ms_max;
+} srix_journal;
+
+extern uint32_t journal_commit_count;
+extern uint32_t journal_commit_ms;
+
+bool parse_journal_commit(const char *spec);
+
+/* Group commit */
+bool journal_open(srix_journal *journal, const char *path, journal_ack ack, void *ack_data);
+uint64_t journal_append(srix_journal *journal, const uint8_t *uid, const uint8_t *image, uint32_t blocks);
+bool journal_wait(srix_journal *journal, uint64_t seq);
+bool journal_close(srix_journal *journal);
+void journal_print_stats(const srix_journal *journal, double elapsed_ms);
+
+/* Reading back */
+typedef bool (*journal_visitor)(void *data, const uint8_t *uid, uint64_t time_ms, const uint8_t *image, uint32_t blocks);
+bool journal_scan(const char *path, journal_visitor visitor, void *data, off_t *end);
+bool journal_export(const char *path, const char *dir);
+
+#endif // __NFC_SRIX_JOURNAL_H__
@@ -18,37 +18,180 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <nfc/nfc.h>
 #include <sys/stat.h>
 #include <stdbool.h>
 #include "logging.h"
 #include "nfc_utils.h"
+#include "output.h"
+#include "tag_profile.h"
+#include "block_set.h"
+#include "verify.h"
+#include "devices.h"
+#include "dump.h"
+#include "convert.h"
+#include "journal.h"
+#include "fleet_diff.h"
 #include "commands.c"
 
+/* Long only options */
+enum {
+    OPT_VERIFY_ORDER = 0x100,
+    OPT_VERIFY_SAMPLE,
+    OPT_CONVERT_FROM,
+    OPT_CONVERT_TO,
+    OPT_COMMIT,
+    OPT_TARGET,
+};
+
 int main(int argc, char *argv[], char *envp[]){
 
   //Defult options
   set_skip_confirmation(false);
-  set_eeprom_size(SRIX4K_EEPROM_SIZE);
-  set_eeprom_blocks_amount(SRIX4K_EEPROM_BLOCKS);
+  set_tag_profile(&srix_profiles[SRIX_PROFILE_SRIX4K]);
+  set_tag_profile_forced(false);
   set_verbose(false);
+  set_output_format(OUTPUT_HEX);
 
   // Parse options
+  static const struct option long_options[] = {
+      {"blocks", required_argument, NULL, 'b'},
+      {"verify-order", required_argument, NULL, OPT_VERIFY_ORDER},
+      {"verify-sample", required_argument, NULL, OPT_VERIFY_SAMPLE},
+      {"from", required_argument, NULL, OPT_CONVERT_FROM},
+      {"to", required_argument, NULL, OPT_CONVERT_TO},
+      {"commit", required_argument, NULL, OPT_COMMIT},
+      {"target", required_argument, NULL, OPT_TARGET},
+      {NULL, 0, NULL, 0},
+  };
   int opt = 0;
-  while ((opt = getopt(argc, argv, "hvyt:")) != -1) {
+  output_format format;
+  dump_format convert_format;
+  srix_block_set blocks;
+  while ((opt = getopt_long(argc, argv, "hvyd:t:o:b:", long_options, NULL)) != -1) {
       switch (opt) {
           case 'v': set_verbose(true); break;
           case 'y':set_skip_confirmation(true); break;
+          case 'd': set_reader_connstring(optarg); break;
           case 't':
-              if (strcmp(optarg, "512") == 0) {
-                  set_eeprom_size(SRI512_EEPROM_SIZE);
-                  set_eeprom_blocks_amount(SRI512_EEPROM_BLOCKS);
+              if (strcmp(optarg, "auto") == 0) {
+                  set_tag_profile_forced(false);
+              } else if (srix_profile_by_name(optarg) != NULL) {
+                  set_tag_profile(srix_profile_by_name(optarg));
+                  set_tag_profile_forced(true);
+              } else {
+                  lerror("Unknown tag type \"%s\". Exiting...\n", optarg);
+                  exit(1);
+              }
+              break;
+          case 'o':
+              if (!parse_output_format(optarg, &format)) {
+                  lerror("Unknown output format \"%s\". Exiting...\n", optarg);
+                  exit(1);
+              }
+              set_output_format(format);
+              break;
+          case 'b':
+              if (!block_set_parse(&blocks, optarg)) {
+                  lerror("Invalid block list \"%s\". Exiting...\n", optarg);
+                  exit(1);
+              }
+              set_block_selection(&blocks);
+              break;
+          case OPT_VERIFY_ORDER:
+              if (!parse_verify_order(optarg)) {
+                  lerror("Invalid verify order \"%s\". Exiting...\n", optarg);
+                  exit(1);
+              }
+              break;
+          case OPT_VERIFY_SAMPLE:
+              if (!parse_verify_sample(optarg)) {
+                  lerror("Invalid verify sample \"%s\". Exiting...\n", optarg);
+                  exit(1);
+              }
+              break;
+          case OPT_CONVERT_FROM:
+          case OPT_CONVERT_TO:
+              if (!parse_dump_format(optarg, &convert_format)) {
+                  lerror("Unknown dump format \"%s\". Exiting...\n", optarg);
+                  exit(1);
+              }
+              if (opt == OPT_CONVERT_FROM) set_convert_from(convert_format);
+              else set_convert_to(convert_format);
+              break;
+          case OPT_TARGET: set_target_connstring(optarg); break;
+          case OPT_COMMIT:
+              if (!parse_journal_commit(optarg)) {
+                  lerror("Invalid commit window \"%s\". Exiting...\n", optarg);
+                  exit(1);
               }
               break;
-          
       }
   }
 
+  // Run a single command
+  if (optind < argc) {
+      if (strcmp(argv[optind], "verify") == 0 && optind + 1 < argc) {
+          return verify_tag(argv[optind + 1]) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "convert") == 0 && optind + 2 < argc) {
+          return convert_dumps(argv[optind + 1], argv[optind + 2]) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "patch") == 0 && optind + 1 < argc) {
+          return patch_tag(argv[optind + 1]) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "encode") == 0 && optind + 1 < argc) {
+          encode_spool(argv[optind + 1]);
+          return 0;
+      }
+      if (strcmp(argv[optind], "clone") == 0) {
+          clone_tags();
+          return 0;
+      }
+      if (strcmp(argv[optind], "watch") == 0) {
+          watch_readers();
+          return 0;
+      }
+      if (strcmp(argv[optind], "station") == 0 && optind + 1 < argc) {
+          read_station(argv[optind + 1]);
+          return 0;
+      }
+      if (strcmp(argv[optind], "export") == 0 && optind + 2 < argc) {
+          return journal_export(argv[optind + 1], argv[optind + 2]) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "bench") == 0 && optind + 1 < argc) {
+          int rounds = atoi(argv[optind + 1]);
+          if (rounds <= 0) {
+              lerror("Invalid bench rounds \"%s\". Exiting...\n", argv[optind + 1]);
+              return 1;
+          }
+          return bench_reader(rounds) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "soak") == 0 && optind + 2 < argc) {
+          char *end;
+          unsigned long cycles = strtoul(argv[optind + 1], &end, 10);
+          if (*end != '\0' || end == argv[optind + 1] || cycles > UINT32_MAX) {
+              lerror("Invalid soak cycles \"%s\". Exiting...\n", argv[optind + 1]);
+              return 1;
+          }
+          return soak_tag(cycles, argv[optind + 2]) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "soak-report") == 0 && optind + 1 < argc) {
+          return soak_report(argv[optind + 1]) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "diff-fleet") == 0 && optind + 2 < argc) {
+          return fleet_diff(argv[optind + 1], argv[optind + 2], optind + 3 < argc ? argv[optind + 3] : NULL) ? 0 : 1;
+      }
+      if (strcmp(argv[optind], "restore") == 0 && optind + 1 < argc) {
+          restore_tags(argv[optind + 1]);
+          return 0;
+      }
+
+      print_options(argv[0]);
+      return 1;
+  }
+
   int choice = 0;
 
     while(true){
@@ -64,13 +207,20 @@ int main(int argc, char *argv[], char *envp[]){
         printf(GREEN "7) " RESET "Write EEPROM file to NFC tag\n" );
         printf(GREEN "8) " RESET "Reset OTP Blocks\n" );
         printf(GREEN "9) " RESET "Help\n" );
+        printf(GREEN "10) " RESET "Verify NFC tag against a file\n" );
+        printf(GREEN "11) " RESET "Restore NFC tags from a dump directory\n" );
+        printf(GREEN "12) " RESET "Read NFC tags into a journal\n" );
+        printf(GREEN "13) " RESET "Clone NFC tag to other tags\n" );
+        printf(GREEN "14) " RESET "Encode NFC tags from a spool directory\n" );
+        printf(GREEN "15) " RESET "Patch NFC tag with a script\n" );
+        printf(GREEN "16) " RESET "Soak test NFC tag writes\n" );
         printf(GREEN "0) " RESET "Exit\n" );  
 
         printf(YELLOW "\n>>> Choose an option: " RESET);
         scanf("%d", &choice); 
 
         switch (choice){
-            case 1: system("nfc-list"); break;
+            case 1: list_devices(); break;
             case 2: read_eeprom_content(); break;  
             case 3: read_tag_info(); break;
             case 4: write_eeprom_to_file(); break;
@@ -79,6 +229,13 @@ int main(int argc, char *argv[], char *envp[]){
             case 7: write_to_tag(); break;
             case 8: otp_reset(); break;
             case 9: print_options(argv[0]); break;        
+            case 10: verify_tag_prompt(); break;
+            case 11: restore_tags_prompt(); break;
+            case 12: read_station_prompt(); break;
+            case 13: clone_tags(); break;
+            case 14: encode_spool_prompt(); break;
+            case 15: patch_tag_prompt(); break;
+            case 16: soak_tag_prompt(); break;
             case 0: exit(0);
         }
 
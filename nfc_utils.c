@@ -14,9 +14,19 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <nfc/nfc.h>
 #include "nfc_utils.h"
 #include "logging.h"
+#include "tag_profile.h"
+#include "transport.h"
+#include "health.h"
+#include "trace.h"
 
 const nfc_modulation nmISO14443B = {
         .nmt = NMT_ISO14443B,
@@ -28,6 +38,12 @@ const nfc_modulation nmISO14443B2SR = {
         .nbr = NBR_106,
 };
 
+srix_transport *active_transport = NULL;
+
+void set_active_transport(srix_transport *transport) {
+    active_transport = transport;
+}
+
 void log_command_sent(const uint8_t *command, size_t num_bytes) {
     if (verbosity_level < 2) {
         return;
@@ -56,37 +72,64 @@ void log_command_received(const uint8_t *command, size_t num_bytes) {
     printf("\n");
 }
 
-size_t nfc_transceive_bytes(nfc_device *reader, const uint8_t *tx_data, size_t tx_size, uint8_t *rx_data) {
+/*
+ * rx_size is the capacity of rx_data, responses that do not fit are reported
+ * as errors by libnfc. Returns the number of bytes received, 0 on error.
+ */
+size_t nfc_transceive_bytes(nfc_device *reader, const uint8_t *tx_data, size_t tx_size, uint8_t *rx_data, size_t rx_size) {
     log_command_sent(tx_data, tx_size);
+    TRACE3(frame_send, tx_data[0], tx_data, tx_size);
 
-    size_t rx_size = nfc_initiator_transceive_bytes(reader, tx_data, tx_size, rx_data, sizeof(rx_data), 0);
+    int res;
+    double start = monotonic_ms();
+    if (active_transport != NULL && reader == NULL) {
+        res = active_transport->transceive(active_transport->ctx, tx_data, tx_size, rx_data, rx_size);
+    } else {
+        res = nfc_initiator_transceive_bytes(reader, tx_data, tx_size, rx_data, rx_size, 0);
+    }
+    TRACE3(frame_receive, tx_data[0], rx_data, res);
+
+    // Writes get no answer, only frames that expect one can fail
+    health_record(health_for_device(reader), rx_size == 0 || res == (int) rx_size, monotonic_ms() - start);
+    if (res < 0) {
+        if (verbosity_level >= 2) printf("RX << error %d\n", res);
+        return 0;
+    }
 
     if (rx_data != NULL) {
-        log_command_received(rx_data, rx_size);
+        log_command_received(rx_data, res);
     }
 
-    return rx_size;
+    return res;
 }
 
-size_t nfc_srix_get_uid(nfc_device *reader, uint8_t *rx_data) {
+size_t nfc_srix_get_uid(nfc_device *reader, srix_uid_frame rx_data) {
     uint8_t cmd[1] = {SR_GET_UID_COMMAND};
-    return nfc_transceive_bytes(reader, cmd, sizeof(cmd), rx_data);
+    return nfc_transceive_bytes(reader, cmd, sizeof(cmd), rx_data, SR_GET_UID_RESPONSE_LEN);
 }
 
-size_t nfc_srix_read_block(nfc_device *reader, uint8_t *rx_data, uint8_t block) {
+size_t nfc_srix_read_block(nfc_device *reader, srix_block_frame rx_data, uint8_t block) {
     uint8_t cmd[2] = {SR_READ_BLOCK_COMMAND};
     cmd[1] = block;
-    return nfc_transceive_bytes(reader, cmd, sizeof(cmd), rx_data);
+
+    TRACE1(block_read_start, block);
+    size_t res = nfc_transceive_bytes(reader, cmd, sizeof(cmd), rx_data, SR_READ_BLOCK_RESPONSE_LEN);
+    TRACE2(block_read_done, block, res);
+    return res;
 }
 
-size_t nfc_srix_write_block(nfc_device *reader, uint8_t *rx_data, uint8_t block, const uint8_t *data) {
+size_t nfc_srix_write_block(nfc_device *reader, uint8_t block, const srix_block_frame data) {
     uint8_t cmd[6] = {SR_WRITE_BLOCK_COMMAND};
     cmd[1] = block;
     cmd[2] = data[0];
     cmd[3] = data[1];
     cmd[4] = data[2];
     cmd[5] = data[3];
-    return nfc_transceive_bytes(reader, cmd, sizeof(cmd), rx_data);
+
+    TRACE1(block_write_start, block);
+    size_t res = nfc_transceive_bytes(reader, cmd, sizeof(cmd), NULL, SR_WRITE_BLOCK_RESPONSE_LEN);
+    TRACE2(block_write_done, block, res);
+    return res;
 }
 
 void nfc_write_block(nfc_device *pnd, uint32_t block, uint8_t block_num) {
@@ -97,33 +140,77 @@ void nfc_write_block(nfc_device *pnd, uint32_t block, uint8_t block_num) {
     bytes[3] = block >> 0u;
 
     printf("Writing block %02X... ", block_num);
-    nfc_srix_write_block(pnd, NULL, block_num, bytes);
+    nfc_srix_write_block(pnd, block_num, bytes);
     printf("Done!\n");
 }
 
 void nfc_write_block_bytes(nfc_device *pnd, uint8_t *block, uint8_t block_num) {
     printf("Writing block %02X... ", block_num);
-    nfc_srix_write_block(pnd, NULL, block_num, block);
+    nfc_srix_write_block(pnd, block_num, block);
     printf("Done!\n");
 }
 
 char *srix_get_block_type(uint8_t block_num) {
-    if (block_num < 5) {
+    if (block_num == tag_profile->system_block) {
+        return "System";
+    } else if (block_num >= tag_profile->otp_first && block_num <= tag_profile->otp_last) {
         return "Resettable OTP bits";
-    } else if (block_num < 7) {
+    } else if (block_num >= tag_profile->counter_first && block_num <= tag_profile->counter_last) {
         return "Count down counter";
-    } else if (block_num < 16) {
+    } else if (block_num >= tag_profile->lockable_first && block_num <= tag_profile->lockable_last) {
         return "Lockable EEPROM";
     } else {
         return "EEPROM";
     }
 }
 
-uint32_t eeprom_bytes_to_block(uint8_t *dump, uint8_t block) {
-    return (dump[(block*4)] << 24u) + (dump[(block*4)+1] << 16u) + (dump[(block*4)+2] << 8u) + dump[(block*4)+3];
+uint32_t eeprom_bytes_to_block(const uint8_t *dump, uint8_t block) {
+    return ((uint32_t) dump[(block*4)] << 24u) + (dump[(block*4)+1] << 16u) + (dump[(block*4)+2] << 8u) + dump[(block*4)+3];
+}
+
+bool eeprom_block_differs(const uint8_t *dump, const uint8_t *eeprom, uint8_t block) {
+    return memcmp(dump + (block * 4), eeprom + (block * 4), 4) != 0;
+}
+
+// Print a GET_UID response MSB first, out must hold 17 chars
+void srix_uid_to_string(const uint8_t *uid, char *out) {
+    for (int i = 0; i < 8; i++) {
+        sprintf(out + i * 2, "%02X", uid[7 - i]);
+    }
+}
+
+double monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Sync the directory holding path, so a new or renamed entry survives a power cut
+bool sync_parent_dir(const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int) (slash - path), path);
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
 }
 
 void close_nfc(nfc_context *context, nfc_device *reader) {
+    if (active_transport != NULL) {
+        active_transport->close(active_transport->ctx);
+        active_transport = NULL;
+    }
     if (reader != NULL) nfc_close(reader);
     if (context != NULL) nfc_exit(context);
 }
\ No newline at end of file
@@ -28,6 +28,14 @@
 #define SR_GET_UID_COMMAND 0x0B
 #define SR_READ_BLOCK_COMMAND 0x08
 #define SR_WRITE_BLOCK_COMMAND 0x09
+#define SR_GET_UID_RESPONSE_LEN 8
+#define SR_READ_BLOCK_RESPONSE_LEN 4
+#define SR_WRITE_BLOCK_RESPONSE_LEN 0
+#define TAG_PRESENCE_POLL_US 100000
+
+/* Frames */
+typedef uint8_t srix_uid_frame[SR_GET_UID_RESPONSE_LEN];
+typedef uint8_t srix_block_frame[SR_READ_BLOCK_RESPONSE_LEN];
 
 /* Constants */
 extern const nfc_modulation nmISO14443B;
@@ -38,16 +46,20 @@ void log_command_sent(const uint8_t *command, size_t num_bytes);
 void log_command_received(const uint8_t *command, size_t num_bytes);
 
 /* Commands */
-size_t nfc_transceive_bytes(nfc_device *reader, const uint8_t *tx_data, size_t tx_size, uint8_t *rx_data);
-size_t nfc_srix_get_uid(nfc_device *reader, uint8_t *rx_data);
-size_t nfc_srix_read_block(nfc_device *reader, uint8_t *rx_data, uint8_t block);
-size_t nfc_srix_write_block(nfc_device *reader, uint8_t *rx_data, uint8_t block, const uint8_t *data);
+size_t nfc_transceive_bytes(nfc_device *reader, const uint8_t *tx_data, size_t tx_size, uint8_t *rx_data, size_t rx_size);
+size_t nfc_srix_get_uid(nfc_device *reader, srix_uid_frame rx_data);
+size_t nfc_srix_read_block(nfc_device *reader, srix_block_frame rx_data, uint8_t block);
+size_t nfc_srix_write_block(nfc_device *reader, uint8_t block, const srix_block_frame data);
 void nfc_write_block(nfc_device *pnd, uint32_t block, uint8_t block_num);
 void nfc_write_block_bytes(nfc_device *pnd, uint8_t *block, uint8_t block_num);
 
 /* Utilities */
 char *srix_get_block_type(uint8_t block_num);
-uint32_t eeprom_bytes_to_block(uint8_t *dump, uint8_t block);
+uint32_t eeprom_bytes_to_block(const uint8_t *dump, uint8_t block);
+bool eeprom_block_differs(const uint8_t *dump, const uint8_t *eeprom, uint8_t block);
+void srix_uid_to_string(const uint8_t *uid, char *out);
+double monotonic_ms(void);
+bool sync_parent_dir(const char *path);
 void close_nfc(nfc_context *context, nfc_device *reader);
 
 #endif // __NFC_SRIX_UTILS_H__
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "output.h"
+
+output_format output_fmt = OUTPUT_HEX;
+
+// Large enough for a full SRIX4K listing in any format
+static char output_buf[OUTPUT_MAX_FRAME_LEN + SRIX4K_EEPROM_BLOCKS * OUTPUT_MAX_ROW_LEN];
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+void set_output_format(output_format format) {
+    output_fmt = format;
+}
+
+bool parse_output_format(const char *name, output_format *format) {
+    if (strcmp(name, "hex") == 0) {
+        *format = OUTPUT_HEX;
+    } else if (strcmp(name, "json") == 0) {
+        *format = OUTPUT_JSON;
+    } else if (strcmp(name, "csv") == 0) {
+        *format = OUTPUT_CSV;
+    } else if (strcmp(name, "raw") == 0) {
+        *format = OUTPUT_RAW;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+size_t output_buffer_size(uint32_t blocks, output_format format) {
+    if (format == OUTPUT_RAW) {
+        return blocks * 4;
+    }
+    return OUTPUT_MAX_FRAME_LEN + blocks * OUTPUT_MAX_ROW_LEN;
+}
+
+static char *put_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+static char *put_type(char *p, uint8_t block) {
+    const char *type = srix_get_block_type(block);
+    for (unsigned int i = 0; type[i] && i < OUTPUT_MAX_TYPE_LEN; i++) *p++ = type[i];
+    return p;
+}
+
+static char *put_hex8(char *p, uint8_t byte) {
+    *p++ = hex_digits[byte >> 4u];
+    *p++ = hex_digits[byte & 0xFu];
+    return p;
+}
+
+static char *put_dec(char *p, uint32_t value) {
+    char tmp[10];
+    int n = 0;
+    do {
+        tmp[n++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+/*
+ * Renders a whole tag image into buf in a single pass.
+ * Only blocks in set are rendered, a NULL set renders every block.
+ * buf must hold at least output_buffer_size(blocks, format) bytes.
+ * Returns the number of bytes written, or 0 if buf is too small.
+ */
+size_t output_render_eeprom(char *buf, size_t buf_size, const uint8_t *eeprom, uint32_t blocks, const srix_block_set *set, output_format format, bool color) {
+    if (buf_size < output_buffer_size(blocks, format)) {
+        return 0;
+    }
+
+    char *p = buf;
+    bool first = true;
+    switch (format) {
+        case OUTPUT_RAW:
+            for (uint32_t i = 0; i < blocks; i++) {
+                if (set != NULL && !block_set_has(set, i)) continue;
+                memcpy(p, eeprom + (i * 4), 4);
+                p += 4;
+            }
+            break;
+
+        case OUTPUT_JSON:
+            p = put_str(p, "{\"blocks\":[");
+            for (uint32_t i = 0; i < blocks; i++) {
+                if (set != NULL && !block_set_has(set, i)) continue;
+                const uint8_t *block = eeprom + (i * 4);
+                p = put_str(p, first ? "\n" : ",\n");
+                first = false;
+                p = put_str(p, "{\"block\":");
+                p = put_dec(p, i);
+                p = put_str(p, ",\"data\":\"");
+                for (int j = 0; j < 4; j++) p = put_hex8(p, block[j]);
+                p = put_str(p, "\",\"type\":\"");
+                p = put_type(p, i);
+                p = put_str(p, "\"}");
+            }
+            p = put_str(p, "\n]}\n");
+            break;
+
+        case OUTPUT_CSV:
+            p = put_str(p, "block,data,type\n");
+            for (uint32_t i = 0; i < blocks; i++) {
+                if (set != NULL && !block_set_has(set, i)) continue;
+                const uint8_t *block = eeprom + (i * 4);
+                p = put_hex8(p, i);
+                *p++ = ',';
+                for (int j = 0; j < 4; j++) p = put_hex8(p, block[j]);
+                *p++ = ',';
+                p = put_type(p, i);
+                *p++ = '\n';
+            }
+            break;
+
+        case OUTPUT_HEX:
+        default:
+            for (uint32_t i = 0; i < blocks; i++) {
+                if (set != NULL && !block_set_has(set, i)) continue;
+                const uint8_t *block = eeprom + (i * 4);
+                *p++ = '[';
+                p = put_hex8(p, i);
+                *p++ = ']';
+                for (int j = 0; j < 4; j++) {
+                    *p++ = ' ';
+                    p = put_hex8(p, block[j]);
+                }
+                *p++ = ' ';
+                if (color) p = put_str(p, DIM);
+                p = put_str(p, "--- ");
+                p = put_type(p, i);
+                if (color) p = put_str(p, RESET);
+                *p++ = '\n';
+            }
+            break;
+    }
+
+    return p - buf;
+}
+
+// Render and print a tag image with a single write
+void output_eeprom(const uint8_t *eeprom, uint32_t blocks, const srix_block_set *set) {
+    if (blocks > SRIX4K_EEPROM_BLOCKS) {
+        blocks = SRIX4K_EEPROM_BLOCKS;
+    }
+
+    bool color = isatty(STDOUT_FILENO);
+    size_t len = output_render_eeprom(output_buf, sizeof(output_buf), eeprom, blocks, set, output_fmt, color);
+
+    fwrite(output_buf, 1, len, stdout);
+    fflush(stdout);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_OUTPUT_H__
+#define __NFC_SRIX_OUTPUT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "block_set.h"
+
+/* Macros */
+#define OUTPUT_MAX_TYPE_LEN 32
+#define OUTPUT_MAX_ROW_LEN (64 + OUTPUT_MAX_TYPE_LEN)
+#define OUTPUT_MAX_FRAME_LEN 64
+
+typedef enum {
+    OUTPUT_HEX,
+    OUTPUT_JSON,
+    OUTPUT_CSV,
+    OUTPUT_RAW,
+} output_format;
+
+extern output_format output_fmt;
+
+void set_output_format(output_format);
+bool parse_output_format(const char *name, output_format *format);
+
+/* Rendering */
+size_t output_buffer_size(uint32_t blocks, output_format format);
+size_t output_render_eeprom(char *buf, size_t buf_size, const uint8_t *eeprom, uint32_t blocks, const srix_block_set *set, output_format format, bool color);
+void output_eeprom(const uint8_t *eeprom, uint32_t blocks, const srix_block_set *set);
+
+#endif // __NFC_SRIX_OUTPUT_H__
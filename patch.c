@@ -0,0 +1,231 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "tag_profile.h"
+#include "block_set.h"
+#include "patch.h"
+
+/*
+ * Patch scripts, one operation per line or separated by ';', '#' starts a
+ * comment. Block addresses and values are hex, decrement counts are decimal:
+ *
+ *   10 = 0000FF00 / 0000FF00   # set bits under mask
+ *   11 |= 00000001
+ *   05 -= 1
+ *
+ * Operations run in order on an in-memory image of the affected blocks.
+ */
+
+static bool patch_error(char *error, const char *format, ...) {
+    if (error != NULL) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(error, PATCH_ERROR_LEN, format, args);
+        va_end(args);
+    }
+    return false;
+}
+
+static const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// 1 to max_digits hex digits, NULL if none
+static const char *parse_hex_value(const char *p, const char *end, int max_digits, uint32_t *value) {
+    int digits = 0;
+    *value = 0;
+    while (p < end && hex_digit(*p) >= 0) {
+        if (++digits > max_digits) return NULL;
+        *value = *value << 4u | hex_digit(*p++);
+    }
+    return digits > 0 ? p : NULL;
+}
+
+static const char *parse_count(const char *p, const char *end, uint32_t *value) {
+    uint64_t count = 0;
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        count = count * 10 + (*p++ - '0');
+        if (count > UINT32_MAX) return NULL;
+    }
+    *value = count;
+    return p > start ? p : NULL;
+}
+
+static bool parse_op(const char *p, const char *end, uint32_t line, patch_op *op, char *error) {
+    uint32_t block;
+    p = parse_hex_value(skip_spaces(p, end), end, 2, &block);
+    if (p == NULL || block >= SRIX4K_EEPROM_BLOCKS) return patch_error(error, "bad block address at line %u", line);
+
+    op->block = block;
+    op->line = line;
+    op->mask = 0xFFFFFFFFu;
+    p = skip_spaces(p, end);
+
+    if (p < end && *p == '=') {
+        op->kind = PATCH_SET;
+        p++;
+    } else if (end - p >= 2 && p[1] == '=' && strchr("|&^-", *p) != NULL) {
+        op->kind = *p == '|' ? PATCH_OR : *p == '&' ? PATCH_AND : *p == '^' ? PATCH_XOR : PATCH_DECREMENT;
+        p += 2;
+    } else {
+        return patch_error(error, "expected =, |=, &=, ^= or -= at line %u", line);
+    }
+
+    p = skip_spaces(p, end);
+    if (op->kind == PATCH_DECREMENT) {
+        p = parse_count(p, end, &op->value);
+        if (p == NULL) return patch_error(error, "expected a decimal count at line %u", line);
+    } else {
+        p = parse_hex_value(p, end, 8, &op->value);
+        if (p == NULL) return patch_error(error, "expected up to 8 hex digits at line %u", line);
+    }
+
+    p = skip_spaces(p, end);
+    if (op->kind == PATCH_SET && p < end && *p == '/') {
+        p = parse_hex_value(skip_spaces(p + 1, end), end, 8, &op->mask);
+        if (p == NULL) return patch_error(error, "expected a hex mask at line %u", line);
+        p = skip_spaces(p, end);
+    }
+    if (p != end) return patch_error(error, "unexpected text at line %u", line);
+
+    return true;
+}
+
+bool patch_parse(const char *text, size_t len, patch_script *script, char *error) {
+    const char *p = text;
+    const char *end = text + len;
+    uint32_t line = 1;
+
+    script->count = 0;
+    while (p < end) {
+
+        // One statement: up to newline, ';' or comment
+        const char *stop = p;
+        while (stop < end && *stop != '\n' && *stop != ';' && *stop != '#') stop++;
+
+        const char *first = skip_spaces(p, stop);
+        if (first < stop) {
+            if (script->count == PATCH_MAX_OPS) return patch_error(error, "more than %d operations", PATCH_MAX_OPS);
+            if (!parse_op(first, stop, line, &script->ops[script->count], error)) return false;
+            script->count++;
+        }
+
+        // Drop the comment, move past the separator
+        if (stop < end && *stop == '#') {
+            while (stop < end && *stop != '\n') stop++;
+        }
+        if (stop < end && *stop == '\n') line++;
+        p = stop < end ? stop + 1 : end;
+    }
+
+    if (script->count == 0) return patch_error(error, "no operations");
+    return true;
+}
+
+void patch_blocks(const patch_script *script, srix_block_set *set) {
+    block_set_clear(set);
+    for (uint32_t i = 0; i < script->count; i++) {
+        block_set_add_range(set, script->ops[i].block, script->ops[i].block);
+    }
+}
+
+/*
+ * Run every operation on image of a profile tag, which must hold the affected blocks.
+ * Fails on blocks beyond the tag, decrements of non-counter blocks and counter underflow.
+ */
+bool patch_apply(const patch_script *script, const srix_tag_profile *profile, uint8_t *image, char *error) {
+    for (uint32_t i = 0; i < script->count; i++) {
+        const patch_op *op = &script->ops[i];
+        if (op->block >= profile->blocks) {
+            return patch_error(error, "block %02X is beyond this %s at line %u", op->block, profile->name, op->line);
+        }
+
+        uint8_t *bytes = image + op->block * 4;
+        uint32_t block = eeprom_bytes_to_block(image, op->block);
+
+        switch (op->kind) {
+            case PATCH_SET: block = (block & ~op->mask) | (op->value & op->mask); break;
+            case PATCH_OR: block |= op->value; break;
+            case PATCH_AND: block &= op->value; break;
+            case PATCH_XOR: block ^= op->value; break;
+            case PATCH_DECREMENT: {
+                if (op->block < profile->counter_first || op->block > profile->counter_last) {
+                    return patch_error(error, "block %02X is not a counter at line %u", op->block, op->line);
+                }
+
+                // Counters are little endian on the tag
+                uint32_t counter = bytes[0] | bytes[1] << 8u | bytes[2] << 16u | (uint32_t) bytes[3] << 24u;
+                if (counter < op->value) {
+                    return patch_error(error, "counter %02X is %u, cannot take %u at line %u", op->block, counter, op->value, op->line);
+                }
+                counter -= op->value;
+                bytes[0] = counter;
+                bytes[1] = counter >> 8u;
+                bytes[2] = counter >> 16u;
+                bytes[3] = counter >> 24u;
+                continue;
+            }
+        }
+
+        bytes[0] = block >> 24u;
+        bytes[1] = block >> 16u;
+        bytes[2] = block >> 8u;
+        bytes[3] = block;
+    }
+    return true;
+}
+
+// Prints an error and returns false on failure
+bool patch_load(const char *path, patch_script *script) {
+    char text[PATCH_MAX_TEXT_LEN];
+    char error[PATCH_ERROR_LEN];
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        lerror("Cannot open \"%s\".\n", path);
+        return false;
+    }
+    size_t len = fread(text, 1, sizeof(text), fp);
+    bool too_long = len == sizeof(text) && fgetc(fp) != EOF;
+    fclose(fp);
+
+    if (too_long) {
+        lerror("Cannot load \"%s\": longer than %d bytes.\n", path, PATCH_MAX_TEXT_LEN);
+        return false;
+    }
+    if (!patch_parse(text, len, script, error)) {
+        lerror("Cannot load \"%s\": %s.\n", path, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_PATCH_H__
+#define __NFC_SRIX_PATCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "block_set.h"
+#include "tag_profile.h"
+
+/* Macros */
+#define PATCH_MAX_OPS 256
+#define PATCH_MAX_TEXT_LEN 16384
+#define PATCH_ERROR_LEN 128
+
+typedef enum {
+    PATCH_SET,                // BB = VALUE [/ MASK]
+    PATCH_OR,                 // BB |= VALUE
+    PATCH_AND,                // BB &= VALUE
+    PATCH_XOR,                // BB ^= VALUE
+    PATCH_DECREMENT,          // BB -= COUNT, counter blocks only
+} patch_kind;
+
+/* Values are written as the block is printed, most significant byte first */
+typedef struct {
+    uint8_t block;
+    patch_kind kind;
+    uint32_t value;
+    uint32_t mask;
+    uint32_t line;
+} patch_op;
+
+typedef struct {
+    patch_op ops[PATCH_MAX_OPS];
+    uint32_t count;
+} patch_script;
+
+/* Parsing and applying, no global state */
+bool patch_parse(const char *text, size_t len, patch_script *script, char *error);
+void patch_blocks(const patch_script *script, srix_block_set *set);
+bool patch_apply(const patch_script *script, const srix_tag_profile *profile, uint8_t *image, char *error);
+
+/* Files */
+bool patch_load(const char *path, patch_script *script);
+
+#endif // __NFC_SRIX_PATCH_H__
@@ -0,0 +1,331 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include "logging.h"
+#include "pn532.h"
+
+/*
+ * Lean PN532 HSU driver.
+ * SRx frames are wrapped in InCommunicateThru and written straight to the
+ * serial port; the CIU is set up for ISO14443B once when the port is opened,
+ * like the libnfc ISO14443B workaround in open_nfc_reader().
+ */
+
+typedef struct {
+    int fd;
+    volatile sig_atomic_t aborted;
+    uint8_t chip_id;
+    uint8_t frame[PN532_FRAME_MAX];
+    uint8_t payload[256];
+    uint8_t rx[PN532_FRAME_MAX * 2];
+    size_t rx_len;
+    srix_transport transport;
+} pn532_device;
+
+const uint8_t pn532_ack_frame[6] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+
+// frame must hold len + 9 bytes, len at most PN532_FRAME_MAX - 9
+size_t pn532_build_frame(uint8_t *frame, uint8_t tfi, uint8_t command, const uint8_t *data, size_t len) {
+    uint8_t frame_len = (uint8_t) (len + 2);
+    uint8_t sum = tfi + command;
+
+    frame[0] = 0x00;
+    frame[1] = 0x00;
+    frame[2] = 0xFF;
+    frame[3] = frame_len;
+    frame[4] = (uint8_t) (0x100 - frame_len);
+    frame[5] = tfi;
+    frame[6] = command;
+    for (size_t i = 0; i < len; i++) {
+        frame[7 + i] = data[i];
+        sum += data[i];
+    }
+    frame[7 + len] = (uint8_t) (0x100 - sum);
+    frame[8 + len] = 0x00;
+
+    return len + 9;
+}
+
+/*
+ * Look for a frame at the start of buf.
+ * Returns the bytes used by a complete frame (payload is TFI onwards, NULL for
+ * an ACK), 0 if more bytes are needed, or minus the number of bytes to drop.
+ */
+int pn532_parse_frame(const uint8_t *buf, size_t len, const uint8_t **payload, size_t *payload_len) {
+    size_t i = 0;
+    while (i + 1 < len && !(buf[i] == 0x00 && buf[i + 1] == 0xFF)) i++;
+    if (i > 0) return -(int) i;
+    if (len < 4) return 0;
+
+    uint8_t frame_len = buf[2];
+    uint8_t frame_lcs = buf[3];
+
+    // ACK
+    if (frame_len == 0x00 && frame_lcs == 0xFF) {
+        *payload = NULL;
+        *payload_len = 0;
+        return 4;
+    }
+
+    if ((uint8_t) (frame_len + frame_lcs) != 0 || frame_len == 0) return -2;
+    if (len < (size_t) frame_len + 5) return 0;
+
+    uint8_t sum = 0;
+    for (size_t j = 0; j <= frame_len; j++) sum += buf[4 + j];
+    if (sum != 0) return -2;
+
+    *payload = buf + 4;
+    *payload_len = frame_len;
+    return frame_len + 5;
+}
+
+static bool pn532_write(pn532_device *dev, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(dev->fd, data, len);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+// Next frame from the port, false on timeout
+static bool pn532_read_frame(pn532_device *dev, const uint8_t **payload, size_t *payload_len, int timeout_ms) {
+    while (true) {
+        const uint8_t *frame_payload;
+        size_t frame_payload_len;
+        int ret = pn532_parse_frame(dev->rx, dev->rx_len, &frame_payload, &frame_payload_len);
+
+        if (ret < 0) {
+            memmove(dev->rx, dev->rx - ret, dev->rx_len + ret);
+            dev->rx_len += ret;
+            continue;
+        }
+        if (ret > 0) {
+            // Valid until the next read
+            if (frame_payload != NULL) {
+                memcpy(dev->payload, frame_payload, frame_payload_len);
+                *payload = dev->payload;
+            } else {
+                *payload = NULL;
+            }
+            *payload_len = frame_payload_len;
+            memmove(dev->rx, dev->rx + ret, dev->rx_len - ret);
+            dev->rx_len -= ret;
+            return true;
+        }
+
+        if (dev->rx_len == sizeof(dev->rx)) {
+            dev->rx_len = 0;
+        }
+
+        struct pollfd pfd = {.fd = dev->fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) return false;
+
+        ssize_t got = read(dev->fd, dev->rx + dev->rx_len, sizeof(dev->rx) - dev->rx_len);
+        if (got <= 0) return false;
+        dev->rx_len += got;
+    }
+}
+
+/*
+ * Send one command and wait for its ACK and response.
+ * Returns the response data length after the response code, or -1.
+ */
+static int pn532_command(pn532_device *dev, uint8_t command, const uint8_t *data, size_t len, uint8_t *resp, size_t resp_size) {
+    if (len > PN532_FRAME_MAX - 9) {
+        return -1;
+    }
+
+    dev->rx_len = 0;
+    size_t frame_len = pn532_build_frame(dev->frame, PN532_TFI_HOST, command, data, len);
+    if (!pn532_write(dev, dev->frame, frame_len)) {
+        return -1;
+    }
+
+    const uint8_t *payload;
+    size_t payload_len;
+    if (!pn532_read_frame(dev, &payload, &payload_len, PN532_ACK_TIMEOUT_MS) || payload != NULL) {
+        lverbose("PN532: no ACK for command %02X.\n", command);
+        return -1;
+    }
+    if (!pn532_read_frame(dev, &payload, &payload_len, PN532_RESPONSE_TIMEOUT_MS) || payload == NULL) {
+        lverbose("PN532: no response for command %02X.\n", command);
+        return -1;
+    }
+    if (payload_len < 2 || payload[0] != PN532_TFI_PN532 || payload[1] != command + 1) {
+        return -1;
+    }
+
+    size_t data_len = payload_len - 2;
+    if (data_len > resp_size) data_len = resp_size;
+    memcpy(resp, payload + 2, data_len);
+    return (int) data_len;
+}
+
+// SRx frame through InCommunicateThru, -1 if the tag did not answer
+static int pn532_thru(pn532_device *dev, const uint8_t *tx, size_t tx_size, uint8_t *rx, size_t rx_size) {
+    uint8_t resp[PN532_FRAME_MAX];
+    int len = pn532_command(dev, PN532_IN_COMMUNICATE_THRU, tx, tx_size, resp, sizeof(resp));
+    if (len < 1) {
+        return -1;
+    }
+
+    // Status 0x01 is a timeout, expected for writes which get no answer
+    if ((resp[0] & 0x3Fu) != 0) {
+        return (resp[0] & 0x3Fu) == 0x01 && rx_size == 0 ? 0 : -1;
+    }
+
+    size_t data_len = len - 1;
+    if (data_len > rx_size) {
+        return -1;
+    }
+    memcpy(rx, resp + 1, data_len);
+    return (int) data_len;
+}
+
+static int pn532_transceive(void *ctx, const uint8_t *tx, size_t tx_size, uint8_t *rx, size_t rx_size) {
+    return pn532_thru(ctx, tx, tx_size, rx, rx_size);
+}
+
+static bool pn532_select(void *ctx, uint8_t *uid) {
+    pn532_device *dev = ctx;
+    dev->aborted = 0;
+
+    while (!dev->aborted) {
+        uint8_t initiate[2] = {SR_INITIATE_COMMAND, 0x00};
+        uint8_t chip_id;
+
+        if (pn532_thru(dev, initiate, sizeof(initiate), &chip_id, 1) == 1) {
+            uint8_t select[2] = {SR_SELECT_COMMAND, chip_id};
+            uint8_t selected;
+            uint8_t get_uid[1] = {0x0B};
+
+            if (pn532_thru(dev, select, sizeof(select), &selected, 1) == 1 && selected == chip_id
+                && pn532_thru(dev, get_uid, sizeof(get_uid), uid, 8) == 8) {
+                dev->chip_id = chip_id;
+                return true;
+            }
+        }
+        usleep(PN532_SELECT_POLL_US);
+    }
+    return false;
+}
+
+static bool pn532_is_present(void *ctx) {
+    uint8_t uid[8];
+    uint8_t get_uid[1] = {0x0B};
+    return pn532_thru(ctx, get_uid, sizeof(get_uid), uid, sizeof(uid)) == 8;
+}
+
+static void pn532_abort(void *ctx) {
+    ((pn532_device *) ctx)->aborted = 1;
+}
+
+static void pn532_close(void *ctx) {
+    pn532_device *dev = ctx;
+    close(dev->fd);
+    free(dev);
+}
+
+static bool pn532_configure_port(int fd) {
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0) {
+        return false;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B115200);
+    cfsetospeed(&tio, B115200);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+/*
+ * Open a PN532 on a serial port, path may carry the "pn532_direct:" prefix.
+ * Returns NULL and prints an error on failure.
+ */
+srix_transport *pn532_open(const char *path) {
+    if (strncmp(path, PN532_DIRECT_PREFIX, strlen(PN532_DIRECT_PREFIX)) == 0) {
+        path += strlen(PN532_DIRECT_PREFIX);
+    }
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0 || !pn532_configure_port(fd)) {
+        lerror("Cannot open PN532 on \"%s\".\n", path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    pn532_device *dev = calloc(1, sizeof(pn532_device));
+    if (dev == NULL) {
+        close(fd);
+        return NULL;
+    }
+    dev->fd = fd;
+
+    // HSU wakeup: a long preamble, then leave low power mode through SAMConfiguration
+    static const uint8_t wakeup[16] = {0x55, 0x55, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    pn532_write(dev, wakeup, sizeof(wakeup));
+
+    uint8_t resp[PN532_FRAME_MAX];
+    uint8_t sam[3] = {0x01, 0x14, 0x01};                // normal mode, 1 s timeout, use IRQ
+    uint8_t timings[4] = {0x02, 0x00, 0x0B, 0x08};      // ATR_RES 102.4 ms, InCommunicateThru 12.8 ms
+    uint8_t retries[4] = {0x05, 0xFF, 0x01, 0x00};      // MxRtyPassiveActivation = 0
+    uint8_t list_b[3] = {0x01, 0x03, 0x00};             // one 106 kbps type B target, AFI 0
+
+    int version = pn532_command(dev, PN532_GET_FIRMWARE_VERSION, NULL, 0, resp, sizeof(resp));
+    uint8_t firmware[2] = {};
+    if (version >= 4) memcpy(firmware, resp + 1, sizeof(firmware));
+    if (version < 4
+        || pn532_command(dev, PN532_SAM_CONFIGURATION, sam, sizeof(sam), resp, sizeof(resp)) < 0
+        || pn532_command(dev, PN532_RF_CONFIGURATION, timings, sizeof(timings), resp, sizeof(resp)) < 0
+        || pn532_command(dev, PN532_RF_CONFIGURATION, retries, sizeof(retries), resp, sizeof(resp)) < 0) {
+        lerror("No PN532 answering on \"%s\".\n", path);
+        pn532_close(dev);
+        return NULL;
+    }
+    lverbose("PN532 firmware %d.%d on %s.\n", firmware[0], firmware[1], path);
+
+    // Same trick as the libnfc workaround: a type B listing sets up the CIU
+    pn532_command(dev, PN532_IN_LIST_PASSIVE_TARGET, list_b, sizeof(list_b), resp, sizeof(resp));
+
+    dev->transport = (srix_transport) {
+            .name = "pn532_direct",
+            .select = pn532_select,
+            .is_present = pn532_is_present,
+            .transceive = pn532_transceive,
+            .abort = pn532_abort,
+            .close = pn532_close,
+            .ctx = dev,
+    };
+    return &dev->transport;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_PN532_H__
+#define __NFC_SRIX_PN532_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "transport.h"
+
+/* Macros */
+#define PN532_DIRECT_PREFIX "pn532_direct:"
+#define PN532_FRAME_MAX 64
+#define PN532_TFI_HOST 0xD4
+#define PN532_TFI_PN532 0xD5
+#define PN532_ACK_TIMEOUT_MS 50
+#define PN532_RESPONSE_TIMEOUT_MS 100
+#define PN532_SELECT_POLL_US 20000
+
+/* Commands */
+#define PN532_GET_FIRMWARE_VERSION 0x02
+#define PN532_SAM_CONFIGURATION 0x14
+#define PN532_RF_CONFIGURATION 0x32
+#define PN532_IN_COMMUNICATE_THRU 0x42
+#define PN532_IN_LIST_PASSIVE_TARGET 0x4A
+
+/* ST SRx anticollision */
+#define SR_INITIATE_COMMAND 0x06
+#define SR_SELECT_COMMAND 0x0E
+
+/* Frames, shared with the emulator */
+extern const uint8_t pn532_ack_frame[6];
+
+size_t pn532_build_frame(uint8_t *frame, uint8_t tfi, uint8_t command, const uint8_t *data, size_t len);
+int pn532_parse_frame(const uint8_t *buf, size_t len, const uint8_t **payload, size_t *payload_len);
+
+/* Transport */
+srix_transport *pn532_open(const char *path);
+
+#endif // __NFC_SRIX_PN532_H__
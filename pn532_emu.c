@@ -0,0 +1,196 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE // posix_openpt
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include "logging.h"
+#include "pn532.h"
+#include "emu_tag.h"
+
+/*
+ * PN532 stand-in on a pseudo terminal.
+ * Answers the HSU commands used by libnfc's pn532_uart driver and by the
+ * direct driver, and serves one emulated SRIX4K through InCommunicateThru.
+ * SIGUSR1 takes the tag out of the field or puts it back.
+ */
+
+static srix_emu_tag tag;
+static useconds_t response_latency = 0;
+
+static void toggle_tag(int sig) {
+    tag.present = !tag.present;
+}
+
+static void write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(fd, data, len);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return;
+        data += ret;
+        len -= ret;
+    }
+}
+
+// Response data for one host command
+static size_t emulate_command(uint8_t command, const uint8_t *data, size_t len, uint8_t *resp) {
+    switch (command) {
+        case 0x00: // Diagnose, echo the test data
+            memcpy(resp, data, len);
+            return len;
+        case PN532_GET_FIRMWARE_VERSION:
+            resp[0] = 0x32;
+            resp[1] = 0x01;
+            resp[2] = 0x06;
+            resp[3] = 0x07;
+            return 4;
+        case 0x06: // ReadRegister, one byte per address
+            memset(resp, 0, len / 2);
+            return len / 2;
+        case PN532_IN_LIST_PASSIVE_TARGET:
+            resp[0] = 0x00;
+            return 1;
+        case PN532_IN_COMMUNICATE_THRU: {
+            int answer = emu_tag_frame(&tag, data, len, resp + 1);
+            resp[0] = answer < 0 ? 0x01 : 0x00;
+            return answer < 0 ? 1 : answer + 1;
+        }
+        case 0x44: // InDeselect
+        case 0x52: // InRelease
+            resp[0] = 0x00;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int open_pty(void) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        return -1;
+    }
+
+    // Keep the slave open in raw mode so clients can come and go
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) < 0) {
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    return master;
+}
+
+static void print_usage(const char *executable) {
+    printf("Usage: %s [-v] [-l latency_us] [-t wear=N,latency=US,seed=S] [image.bin]\n", executable);
+    printf("\nOptions:\n");
+    printf("  -v                   enable verbose - print every frame\n");
+    printf("  -l US                delay every response by US microseconds\n");
+    printf("  -t SPEC              tag wear and write time, e.g. wear=100000,latency=3000\n");
+}
+
+int main(int argc, char *argv[]) {
+    set_verbose(false);
+    emu_tag_init(&tag);
+    tag.latency_us = 0;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "hvl:t:")) != -1) {
+        switch (opt) {
+            case 'v': set_verbose(true); break;
+            case 'l': response_latency = atoi(optarg); break;
+            case 't':
+                if (!emu_tag_configure(&tag, optarg)) {
+                    lerror("Invalid tag spec \"%s\". Exiting...\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // Tag content, blank when no image is given
+    if (optind < argc) {
+        FILE *fp = fopen(argv[optind], "rb");
+        if (fp == NULL) {
+            lerror("Cannot open \"%s\". Exiting...\n", argv[optind]);
+            return 1;
+        }
+        size_t read_len = fread(tag.eeprom, 1, sizeof(tag.eeprom), fp);
+        fclose(fp);
+        if (read_len != sizeof(tag.eeprom)) {
+            lerror("Image \"%s\" is shorter than %zu bytes. Exiting...\n", argv[optind], sizeof(tag.eeprom));
+            return 1;
+        }
+    }
+
+    int master = open_pty();
+    if (master < 0) {
+        lerror("Cannot create pseudo terminal. Exiting...\n");
+        return 1;
+    }
+    signal(SIGUSR1, toggle_tag);
+
+    printf("PN532 emulator on %s\n", ptsname(master));
+    fflush(stdout);
+
+    uint8_t buf[PN532_FRAME_MAX * 2];
+    size_t buf_len = 0;
+    while (true) {
+        ssize_t got = read(master, buf + buf_len, sizeof(buf) - buf_len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            usleep(1000);
+            continue;
+        }
+        buf_len += got;
+
+        while (true) {
+            const uint8_t *payload;
+            size_t payload_len;
+            int ret = pn532_parse_frame(buf, buf_len, &payload, &payload_len);
+            if (ret == 0) {
+                if (buf_len == sizeof(buf)) buf_len = 0;
+                break;
+            }
+            if (ret > 0 && payload != NULL && payload_len >= 2 && payload[0] == PN532_TFI_HOST) {
+                uint8_t resp[PN532_FRAME_MAX];
+                uint8_t frame[PN532_FRAME_MAX];
+                size_t resp_len = emulate_command(payload[1], payload + 2, payload_len - 2, resp);
+
+                lverbose("PN532 command %02X, %zu bytes answered.\n", payload[1], resp_len);
+                write_all(master, pn532_ack_frame, sizeof(pn532_ack_frame));
+                if (response_latency > 0) usleep(response_latency);
+                write_all(master, frame, pn532_build_frame(frame, PN532_TFI_PN532, payload[1] + 1, resp, resp_len));
+            }
+
+            size_t used = ret > 0 ? (size_t) ret : (size_t) -ret;
+            memmove(buf, buf + used, buf_len - used);
+            buf_len -= used;
+        }
+    }
+}
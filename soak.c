@@ -0,0 +1,337 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "soak.h"
+
+/*
+ * Write endurance soak.
+ * Every cycle writes a fresh pattern to each block and reads it back. The
+ * first cycles set a baseline, afterwards a CUSUM on the write latency and a
+ * binomial test on the recent failure rate flag the tag drifting away from it.
+ */
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
+
+bool soak_write_header(FILE *fp, const uint8_t *uid) {
+    uint8_t header[SOAK_HEADER_LEN] = {};
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t start_ms = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    put_u32(header, SOAK_MAGIC);
+    put_u16(header + 4, SOAK_VERSION);
+    put_u16(header + 6, SOAK_RECORD_LEN);
+    put_u32(header + 8, start_ms);
+    put_u32(header + 12, start_ms >> 32);
+    memcpy(header + 16, uid, 8);
+    return fwrite(header, sizeof(header), 1, fp) == 1;
+}
+
+bool soak_write_record(FILE *fp, const soak_record *record) {
+    uint8_t bytes[SOAK_RECORD_LEN];
+    put_u32(bytes, record->cycle);
+    put_u32(bytes + 4, record->elapsed_ms);
+    put_u32(bytes + 8, record->write_mean_us);
+    put_u32(bytes + 12, record->write_max_us);
+    put_u32(bytes + 16, record->read_mean_us);
+    put_u16(bytes + 20, record->blocks);
+    put_u16(bytes + 22, record->failures);
+    return fwrite(bytes, sizeof(bytes), 1, fp) == 1;
+}
+
+static void soak_read_record(const uint8_t *bytes, soak_record *record) {
+    record->cycle = get_u32(bytes);
+    record->elapsed_ms = get_u32(bytes + 4);
+    record->write_mean_us = get_u32(bytes + 8);
+    record->write_max_us = get_u32(bytes + 12);
+    record->read_mean_us = get_u32(bytes + 16);
+    record->blocks = get_u16(bytes + 20);
+    record->failures = get_u16(bytes + 22);
+}
+
+/*
+ * Feed one cycle to the detectors.
+ * Latency: one sided CUSUM of the standardized cycle write mean.
+ * Failures: alarm when the window rate exceeds the baseline rate by three standard errors.
+ * Each alarms once when crossing its limit, not on every cycle past it.
+ */
+bool soak_update(soak_stats *stats, const soak_record *record, bool *latency_drift, bool *failure_drift) {
+    *latency_drift = false;
+    *failure_drift = false;
+
+    uint32_t slot = stats->cycles % SOAK_WINDOW_CYCLES;
+    stats->cycles++;
+    stats->writes += record->blocks;
+    stats->failures += record->failures;
+    stats->window_blocks[slot] = record->blocks;
+    stats->window_failures[slot] = record->failures;
+
+    double x = record->write_mean_us;
+    stats->ewma_us = stats->cycles == 1 ? x : stats->ewma_us + 0.1 * (x - stats->ewma_us);
+
+    // Welford mean and variance over the baseline cycles
+    if (stats->baseline_cycles < SOAK_BASELINE_CYCLES) {
+        stats->baseline_cycles++;
+        double delta = x - stats->baseline_mean;
+        stats->baseline_mean += delta / stats->baseline_cycles;
+        stats->baseline_m2 += delta * (x - stats->baseline_mean);
+        stats->baseline_writes += record->blocks;
+        stats->baseline_failures += record->failures;
+        return false;
+    }
+
+    // Scheduler jitter alone must not look like drift: floor the deviation at 5% of
+    // the mean and clip each step so one preempted cycle cannot cross the limit
+    double sd = sqrt(stats->baseline_m2 / (stats->baseline_cycles - 1));
+    if (sd < stats->baseline_mean * 0.05) sd = stats->baseline_mean * 0.05;
+    if (sd < 1) sd = 1;
+    double z = (x - stats->baseline_mean) / sd;
+    if (z > SOAK_CUSUM_CLIP) z = SOAK_CUSUM_CLIP;
+
+    // Capped so a tag that recovers falls back below the limit within a few cycles
+    stats->cusum += z - SOAK_CUSUM_SLACK;
+    if (stats->cusum < 0) stats->cusum = 0;
+    if (stats->cusum > 2 * SOAK_CUSUM_LIMIT) stats->cusum = 2 * SOAK_CUSUM_LIMIT;
+    bool slow = stats->cusum > SOAK_CUSUM_LIMIT;
+    if (slow && !stats->slow) {
+        stats->latency_drifts++;
+        *latency_drift = true;
+    }
+    stats->slow = slow;
+
+    // Laplace smoothing keeps a clean baseline from alarming on the first failure
+    double p0 = (stats->baseline_failures + 1.0) / (stats->baseline_writes + 2.0);
+    uint64_t window_blocks = 0, window_failures = 0;
+    for (uint32_t i = 0; i < SOAK_WINDOW_CYCLES; i++) {
+        window_blocks += stats->window_blocks[i];
+        window_failures += stats->window_failures[i];
+    }
+    bool failing = false;
+    if (window_blocks > 0) {
+        double limit = p0 + 3 * sqrt(p0 * (1 - p0) / window_blocks);
+        failing = (double) window_failures / window_blocks > limit;
+    }
+    if (failing && !stats->failing) {
+        stats->failure_drifts++;
+        *failure_drift = true;
+    }
+    stats->failing = failing;
+
+    if ((*latency_drift || *failure_drift) && stats->first_drift_cycle == 0) {
+        stats->first_drift_cycle = record->cycle;
+    }
+    return *latency_drift || *failure_drift;
+}
+
+static void soak_print_drift(const soak_stats *stats, const soak_record *record, bool latency_drift, bool failure_drift) {
+    if (latency_drift) {
+        lwarning("Cycle %u: write latency drifted to %u us (baseline %.0f us).\n", record->cycle, record->write_mean_us, stats->baseline_mean);
+    }
+    if (failure_drift) {
+        lwarning("Cycle %u: failure rate above baseline, %u of %u blocks failed.\n", record->cycle, record->failures, record->blocks);
+    }
+}
+
+static void soak_print_summary(const soak_stats *stats) {
+    printf("%u cycles, %" PRIu64 " writes, %" PRIu64 " failures, write baseline %.0f us, last %.0f us: ",
+           stats->cycles, stats->writes, stats->failures, stats->baseline_mean, stats->ewma_us);
+    if (stats->latency_drifts == 0 && stats->failure_drifts == 0) {
+        printf(GREEN "no drift" RESET "\n");
+    } else {
+        printf(RED "drift from cycle %u" RESET " (%u latency, %u failure rate)\n",
+               stats->first_drift_cycle, stats->latency_drifts, stats->failure_drifts);
+    }
+}
+
+// Pattern written to block in cycle, never the same twice in a row
+static void soak_pattern(uint32_t cycle, uint8_t block, srix_block_frame data) {
+    uint32_t value = (cycle * 0x9E3779B1u) ^ (block * 0x85EBCA6Bu);
+    value ^= value >> 15;
+    data[0] = value;
+    data[1] = value >> 8;
+    data[2] = value >> 16;
+    data[3] = value >> 24;
+}
+
+/*
+ * Run cycles over blocks and append one record per cycle to path.
+ * Returns false on drift or when the file cannot be written.
+ */
+bool soak_run(nfc_device *reader, const uint8_t *uid, const srix_block_set *blocks, uint32_t cycles, const char *path, volatile sig_atomic_t *stop) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL || !soak_write_header(fp, uid)) {
+        lerror("Cannot write \"%s\".\n", path);
+        if (fp != NULL) fclose(fp);
+        return false;
+    }
+
+    soak_stats stats = {};
+    double start = monotonic_ms();
+    double last_progress = start;
+    bool written = true;
+
+    for (uint32_t cycle = 1; !*stop && (cycles == 0 || cycle <= cycles); cycle++) {
+        soak_record record = {.cycle = cycle};
+        double write_total = 0, read_total = 0, write_max = 0;
+
+        for (uint32_t i = 0; i < SRIX4K_EEPROM_BLOCKS && !*stop; i++) {
+            if (!block_set_has(blocks, i)) continue;
+
+            srix_block_frame data, back;
+            soak_pattern(cycle, i, data);
+
+            double t = monotonic_ms();
+            nfc_srix_write_block(reader, i, data);
+            double write_ms = monotonic_ms() - t;
+
+            t = monotonic_ms();
+            size_t res = nfc_srix_read_block(reader, back, i);
+            read_total += monotonic_ms() - t;
+
+            write_total += write_ms;
+            if (write_ms > write_max) write_max = write_ms;
+            if (res != SR_READ_BLOCK_RESPONSE_LEN || memcmp(back, data, 4) != 0) {
+                lverbose("Cycle %u [%02X]: wrote %08X, read %08X.\n", cycle, i, eeprom_bytes_to_block(data, 0),
+                         res == SR_READ_BLOCK_RESPONSE_LEN ? eeprom_bytes_to_block(back, 0) : 0);
+                record.failures++;
+            }
+            record.blocks++;
+        }
+
+        // A cycle cut short by Ctrl+C is not recorded
+        if (*stop || record.blocks == 0) break;
+
+        record.elapsed_ms = monotonic_ms() - start;
+        record.write_mean_us = write_total * 1000 / record.blocks;
+        record.write_max_us = write_max * 1000;
+        record.read_mean_us = read_total * 1000 / record.blocks;
+
+        if (!soak_write_record(fp, &record)) {
+            written = false;
+            break;
+        }
+        if (cycle % SOAK_FLUSH_CYCLES == 0) fflush(fp);
+
+        bool latency_drift, failure_drift;
+        soak_update(&stats, &record, &latency_drift, &failure_drift);
+        soak_print_drift(&stats, &record, latency_drift, failure_drift);
+
+        if (monotonic_ms() - last_progress >= 1000) {
+            last_progress = monotonic_ms();
+            printf("Cycle %u: write %u us (max %u us), read %u us, %" PRIu64 " failures\n",
+                   cycle, record.write_mean_us, record.write_max_us, record.read_mean_us, stats.failures);
+        }
+    }
+
+    if (fclose(fp) != 0) written = false;
+    if (!written) {
+        lerror("Cannot write \"%s\".\n", path);
+    }
+
+    soak_print_summary(&stats);
+    return written && stats.latency_drifts == 0 && stats.failure_drifts == 0;
+}
+
+// Summarize a time series in SOAK_REPORT_ROWS slices and replay the detectors
+bool soak_report(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        lerror("Cannot open \"%s\".\n", path);
+        return false;
+    }
+
+    uint8_t header[SOAK_HEADER_LEN];
+    if (fread(header, sizeof(header), 1, fp) != 1 || get_u32(header) != SOAK_MAGIC ||
+        get_u16(header + 4) != SOAK_VERSION || get_u16(header + 6) != SOAK_RECORD_LEN) {
+        lerror("\"%s\" is not a soak time series.\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    uint32_t count = (ftell(fp) - SOAK_HEADER_LEN) / SOAK_RECORD_LEN;
+    fseek(fp, SOAK_HEADER_LEN, SEEK_SET);
+
+    char uid[17];
+    srix_uid_to_string(header + 16, uid);
+    time_t started = (time_t) ((get_u32(header + 8) | ((uint64_t) get_u32(header + 12) << 32)) / 1000);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&started));
+    printf("UID %s, started %s, %u cycles\n", uid, date, count);
+
+    uint32_t rows = count < SOAK_REPORT_ROWS ? count : SOAK_REPORT_ROWS;
+    soak_stats stats = {};
+    soak_record record = {};
+    uint32_t done = 0;
+
+    for (uint32_t row = 0; row < rows; row++) {
+        uint32_t last = (uint64_t) count * (row + 1) / rows;
+        uint32_t first_cycle = 0, writes = 0, failures = 0, write_max = 0;
+        double write_sum = 0, read_sum = 0;
+        uint32_t n = 0;
+
+        for (; done < last; done++, n++) {
+            uint8_t bytes[SOAK_RECORD_LEN];
+            if (fread(bytes, sizeof(bytes), 1, fp) != 1) break;
+            soak_read_record(bytes, &record);
+            if (n == 0) first_cycle = record.cycle;
+
+            write_sum += record.write_mean_us;
+            read_sum += record.read_mean_us;
+            if (record.write_max_us > write_max) write_max = record.write_max_us;
+            writes += record.blocks;
+            failures += record.failures;
+
+            bool latency_drift, failure_drift;
+            soak_update(&stats, &record, &latency_drift, &failure_drift);
+            soak_print_drift(&stats, &record, latency_drift, failure_drift);
+        }
+        if (n == 0) break;
+
+        printf("Cycles %u-%u: write %.0f us (max %u us), read %.0f us, %u/%u failed\n",
+               first_cycle, record.cycle, write_sum / n, write_max, read_sum / n, failures, writes);
+    }
+    fclose(fp);
+
+    soak_print_summary(&stats);
+    return stats.latency_drifts == 0 && stats.failure_drifts == 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_SOAK_H__
+#define __NFC_SRIX_SOAK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include <nfc/nfc.h>
+#include "block_set.h"
+
+/* Macros */
+#define SOAK_MAGIC 0x53585253u              // "SRXS"
+#define SOAK_VERSION 1
+#define SOAK_HEADER_LEN 32
+#define SOAK_RECORD_LEN 24
+#define SOAK_BASELINE_CYCLES 50             // cycles that define normal behaviour
+#define SOAK_WINDOW_CYCLES 50               // recent cycles for the failure rate
+#define SOAK_CUSUM_SLACK 0.5                // in baseline standard deviations
+#define SOAK_CUSUM_LIMIT 8.0
+#define SOAK_CUSUM_CLIP 3.0                 // largest step of a single cycle
+#define SOAK_FLUSH_CYCLES 64
+#define SOAK_REPORT_ROWS 10
+
+/*
+ * Time series file, little endian.
+ * Header: magic u32, version u16, record length u16, start unix ms u64, uid[8], reserved[8].
+ * Record per cycle: cycle u32, ms since start u32, write mean us u32,
+ * write max us u32, read mean us u32, blocks u16, failures u16.
+ */
+typedef struct {
+    uint32_t cycle;
+    uint32_t elapsed_ms;
+    uint32_t write_mean_us;
+    uint32_t write_max_us;
+    uint32_t read_mean_us;
+    uint16_t blocks;
+    uint16_t failures;
+} soak_record;
+
+typedef struct {
+    uint32_t cycles;
+    uint64_t writes;
+    uint64_t failures;
+
+    // Baseline of the cycle write latency and failure rate
+    uint32_t baseline_cycles;
+    double baseline_mean;
+    double baseline_m2;
+    uint64_t baseline_writes;
+    uint64_t baseline_failures;
+
+    // Drift detectors
+    double cusum;
+    double ewma_us;
+    uint16_t window_blocks[SOAK_WINDOW_CYCLES];
+    uint16_t window_failures[SOAK_WINDOW_CYCLES];
+    bool slow;                          // CUSUM above its limit
+    bool failing;                       // window rate above the baseline limit
+    uint32_t latency_drifts;
+    uint32_t failure_drifts;
+    uint32_t first_drift_cycle;
+} soak_stats;
+
+/* Time series */
+bool soak_write_header(FILE *fp, const uint8_t *uid);
+bool soak_write_record(FILE *fp, const soak_record *record);
+bool soak_report(const char *path);
+
+/* Drift detection, true when this cycle starts a drift */
+bool soak_update(soak_stats *stats, const soak_record *record, bool *latency_drift, bool *failure_drift);
+
+/* Endurance loop on the open reader, cycles 0 runs until stop is set */
+bool soak_run(nfc_device *reader, const uint8_t *uid, const srix_block_set *blocks, uint32_t cycles, const char *path, volatile sig_atomic_t *stop);
+
+#endif // __NFC_SRIX_SOAK_H__
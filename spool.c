@@ -0,0 +1,348 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "tag_profile.h"
+#include "block_set.h"
+#include "dump.h"
+#include "spool.h"
+
+/*
+ * Watch-folder intake.
+ * An intake thread follows the spool directory with inotify, parses and
+ * validates every new dump and keeps up to SPOOL_READY_MAX write plans in
+ * memory. The encoding loop only takes plans from that queue; moving files to
+ * done/ or error/ is handed back to the intake thread as well.
+ */
+
+typedef struct {
+    char **names;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} spool_names;
+
+static bool spool_candidate(const char *name) {
+    size_t len = strlen(name);
+    return name[0] != '.' && !(len > 4 && strcmp(name + len - 4, ".tmp") == 0);
+}
+
+static void names_push(spool_names *names, const char *name) {
+    for (size_t i = names->head; i < names->count; i++) {
+        if (strcmp(names->names[i], name) == 0) return;
+    }
+
+    if (names->head > 0 && names->head == names->count) {
+        names->head = names->count = 0;
+    }
+    if (names->count == names->capacity) {
+        size_t capacity = names->capacity ? names->capacity * 2 : 64;
+        char **grown = realloc(names->names, capacity * sizeof(char *));
+        if (grown == NULL) return;
+        names->names = grown;
+        names->capacity = capacity;
+    }
+    names->names[names->count] = strdup(name);
+    if (names->names[names->count] != NULL) names->count++;
+}
+
+static void spool_move(spool *spool, const char *name, const char *subdir) {
+    char from[PATH_MAX], to[PATH_MAX];
+    snprintf(from, sizeof(from), "%s/%s", spool->dir, name);
+    snprintf(to, sizeof(to), "%s/%s/%s", spool->dir, subdir, name);
+    if (rename(from, to) != 0) {
+        lwarning("Cannot move \"%s\" to %s/: %s\n", from, subdir, strerror(errno));
+    }
+}
+
+// Queued, being encoded or waiting for its move: a late event for it is stale
+static bool spool_known(spool *spool, const char *name) {
+    bool known = false;
+    pthread_mutex_lock(&spool->lock);
+    for (size_t i = 0; i < spool->ready_count && !known; i++) {
+        known = strcmp(spool->ready[(spool->ready_head + i) % SPOOL_READY_MAX].name, name) == 0;
+    }
+    for (size_t i = 0; i < spool->finished_count && !known; i++) {
+        known = strcmp(spool->finished[i].name, name) == 0;
+    }
+    pthread_mutex_unlock(&spool->lock);
+    return known;
+}
+
+// Parse and validate one dump, false rejects it
+static bool spool_prepare(spool *spool, const char *name, spool_job *job) {
+    char path[PATH_MAX];
+    char error[DUMP_ERROR_LEN];
+    dump_info info;
+
+    snprintf(path, sizeof(path), "%s/%s", spool->dir, name);
+    snprintf(job->name, sizeof(job->name), "%s", name);
+
+    if (!dump_load_file(path, DUMP_FORMAT_AUTO, job->image, &info, error)) {
+        lwarning("Job \"%s\" rejected: %s.\n", name, error);
+        return false;
+    }
+
+    job->blocks = info.blocks;
+    job->profile = srix_profile_from_size(info.blocks * 4);
+    if (job->profile == NULL) {
+        lwarning("Job \"%s\" rejected: %u blocks is not an SRIX4K or SRI512 dump.\n", name, info.blocks);
+        return false;
+    }
+    if (tag_profile_forced && info.blocks != eeprom_blocks_amount) {
+        lwarning("Job \"%s\" rejected: %u blocks, -t %s expects %u.\n", name, info.blocks, tag_profile->name, eeprom_blocks_amount);
+        return false;
+    }
+
+    // Selected blocks that exist in this dump
+    block_set_clear(&job->plan);
+    const srix_block_set *selection = selected_blocks();
+    for (uint32_t i = 0; i < job->blocks; i++) {
+        if (block_set_has(selection, i)) block_set_add_range(&job->plan, i, i);
+    }
+    if (block_set_count(&job->plan, job->blocks) == 0) {
+        lwarning("Job \"%s\" rejected: no selected block in the dump.\n", name);
+        return false;
+    }
+    return true;
+}
+
+static void *spool_intake(void *arg) {
+    spool *spool = arg;
+    spool_names pending = {};
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    // Files already waiting, oldest name first
+    struct dirent **entries;
+    int entry_count = scandir(spool->dir, &entries, NULL, alphasort);
+    for (int i = 0; i < entry_count; i++) {
+        if (entries[i]->d_type != DT_DIR && spool_candidate(entries[i]->d_name)) {
+            names_push(&pending, entries[i]->d_name);
+        }
+        free(entries[i]);
+    }
+    if (entry_count >= 0) free(entries);
+
+    // The watch predates the scan, so these may still be half written
+    size_t scanned = pending.count;
+
+    while (true) {
+
+        // Move finished jobs out of the way
+        spool_result finished[SPOOL_READY_MAX];
+        pthread_mutex_lock(&spool->lock);
+        size_t finished_count = spool->finished_count;
+        memcpy(finished, spool->finished, finished_count * sizeof(spool_result));
+        spool->finished_count = 0;
+        bool closing = spool->closing;
+        pthread_mutex_unlock(&spool->lock);
+
+        for (size_t i = 0; i < finished_count; i++) {
+            spool_move(spool, finished[i].name, finished[i].ok ? SPOOL_DONE_DIR : SPOOL_ERROR_DIR);
+        }
+        if (closing) break;
+
+        // Prepare plans while there is room
+        while (pending.head < pending.count) {
+            pthread_mutex_lock(&spool->lock);
+            bool room = spool->ready_count < SPOOL_READY_MAX;
+            pthread_mutex_unlock(&spool->lock);
+            if (!room) break;
+
+            char *name = pending.names[pending.head++];
+            bool startup = scanned > 0;
+            if (startup) scanned--;
+
+            // Seen by both the scan and the watch, or already moved away
+            char path[PATH_MAX];
+            struct stat file_stat;
+            snprintf(path, sizeof(path), "%s/%s", spool->dir, name);
+            if (spool_known(spool, name) || stat(path, &file_stat) != 0) {
+                free(name);
+                continue;
+            }
+
+            spool_job job;
+            if (spool_prepare(spool, name, &job)) {
+                pthread_mutex_lock(&spool->lock);
+                spool->ready[(spool->ready_head + spool->ready_count) % SPOOL_READY_MAX] = job;
+                spool->ready_count++;
+                spool->prepared++;
+                pthread_cond_signal(&spool->ready_cond);
+                pthread_mutex_unlock(&spool->lock);
+                lverbose("Job \"%s\" ready, %u blocks.\n", name, block_set_count(&job.plan, job.blocks));
+            } else {
+                // Its close event requeues it if it was still being written
+                if (startup) {
+                    lwarning("Job \"%s\" left in place.\n", name);
+                } else {
+                    spool_move(spool, name, SPOOL_ERROR_DIR);
+                }
+                pthread_mutex_lock(&spool->lock);
+                spool->rejected++;
+                pthread_mutex_unlock(&spool->lock);
+            }
+            free(name);
+        }
+
+        struct pollfd fds[2] = {
+                {.fd = spool->inotify_fd, .events = POLLIN},
+                {.fd = spool->wake_fd, .events = POLLIN},
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            if (read(spool->wake_fd, &value, sizeof(value)) < 0) continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            ssize_t len = read(spool->inotify_fd, buf, sizeof(buf));
+            for (ssize_t i = 0; i < len;) {
+                const struct inotify_event *event = (const struct inotify_event *) (buf + i);
+                if (event->len > 0 && !(event->mask & IN_ISDIR) && spool_candidate(event->name)) {
+                    names_push(&pending, event->name);
+                }
+                i += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    for (size_t i = pending.head; i < pending.count; i++) free(pending.names[i]);
+    free(pending.names);
+    return NULL;
+}
+
+static void spool_wake(spool *spool) {
+    uint64_t one = 1;
+    if (write(spool->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        lverbose("Cannot wake spool intake.\n");
+    }
+}
+
+/*
+ * Start watching dir, creating its done/ and error/ directories.
+ * Prints an error and returns false on failure.
+ */
+bool spool_open(spool *spool, const char *dir) {
+    memset(spool, 0, sizeof(*spool));
+    spool->inotify_fd = spool->wake_fd = -1;
+
+    char path[PATH_MAX];
+    const char *subdirs[2] = {SPOOL_DONE_DIR, SPOOL_ERROR_DIR};
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, subdirs[i]);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            lerror("Cannot create \"%s\": %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+
+    // Only complete files: written and closed, or moved in
+    spool->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (spool->inotify_fd < 0 || inotify_add_watch(spool->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        lerror("Cannot watch \"%s\": %s\n", dir, strerror(errno));
+        if (spool->inotify_fd >= 0) close(spool->inotify_fd);
+        return false;
+    }
+
+    spool->dir = strdup(dir);
+    spool->wake_fd = eventfd(0, EFD_CLOEXEC);
+    pthread_mutex_init(&spool->lock, NULL);
+    pthread_cond_init(&spool->ready_cond, NULL);
+    if (spool->dir == NULL || spool->wake_fd < 0 || pthread_create(&spool->intake, NULL, spool_intake, spool) != 0) {
+        lerror("Cannot start spool intake.\n");
+        close(spool->inotify_fd);
+        if (spool->wake_fd >= 0) close(spool->wake_fd);
+        free(spool->dir);
+        return false;
+    }
+    return true;
+}
+
+// Next prepared job, NULL if none became ready within timeout_ms
+const spool_job *spool_front(spool *spool, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&spool->lock);
+    while (spool->ready_count == 0) {
+        if (pthread_cond_timedwait(&spool->ready_cond, &spool->lock, &deadline) != 0) break;
+    }
+    const spool_job *job = spool->ready_count > 0 ? &spool->ready[spool->ready_head] : NULL;
+    pthread_mutex_unlock(&spool->lock);
+
+    // Only this thread pops, the slot stays valid until spool_finish
+    return job;
+}
+
+// Drop the front job, its file goes to done/ or error/
+void spool_finish(spool *spool, bool ok) {
+    pthread_mutex_lock(&spool->lock);
+    spool_job *job = &spool->ready[spool->ready_head];
+    bool queued = spool->finished_count < SPOOL_READY_MAX;
+    spool_result result = {.ok = ok};
+    memcpy(result.name, job->name, sizeof(result.name));
+    if (queued) {
+        spool->finished[spool->finished_count++] = result;
+    }
+    spool->ready_head = (spool->ready_head + 1) % SPOOL_READY_MAX;
+    spool->ready_count--;
+    pthread_mutex_unlock(&spool->lock);
+
+    if (!queued) {
+        spool_move(spool, result.name, ok ? SPOOL_DONE_DIR : SPOOL_ERROR_DIR);
+    }
+    spool_wake(spool);
+}
+
+// Stop intake, prepared but unused jobs stay in the spool directory
+void spool_close(spool *spool) {
+    pthread_mutex_lock(&spool->lock);
+    spool->closing = true;
+    pthread_mutex_unlock(&spool->lock);
+    spool_wake(spool);
+    pthread_join(spool->intake, NULL);
+
+    pthread_mutex_destroy(&spool->lock);
+    pthread_cond_destroy(&spool->ready_cond);
+    close(spool->inotify_fd);
+    close(spool->wake_fd);
+    free(spool->dir);
+}
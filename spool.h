@@ -0,0 +1,72 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_SPOOL_H__
+#define __NFC_SRIX_SPOOL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include "block_set.h"
+#include "tag_profile.h"
+
+/* Macros */
+#define SPOOL_READY_MAX 16
+#define SPOOL_DONE_DIR "done"
+#define SPOOL_ERROR_DIR "error"
+
+/* Parsed and validated dump waiting for a tag */
+typedef struct {
+    char name[NAME_MAX + 1];
+    uint8_t image[SRIX4K_EEPROM_SIZE];
+    uint32_t blocks;
+    const srix_tag_profile *profile;
+    srix_block_set plan;      // blocks to compare and write
+} spool_job;
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    bool ok;
+} spool_result;
+
+typedef struct {
+    char *dir;
+    int inotify_fd;
+    int wake_fd;              // eventfd, consumer freed a slot or finished a job
+    pthread_t intake;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+    spool_job ready[SPOOL_READY_MAX];
+    size_t ready_head;
+    size_t ready_count;
+    spool_result finished[SPOOL_READY_MAX];
+    size_t finished_count;
+    bool closing;
+
+    // Statistics
+    uint32_t prepared;
+    uint32_t rejected;
+} spool;
+
+bool spool_open(spool *spool, const char *dir);
+const spool_job *spool_front(spool *spool, int timeout_ms);
+void spool_finish(spool *spool, bool ok);
+void spool_close(spool *spool);
+
+#endif // __NFC_SRIX_SPOOL_H__
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "logging.h"
+#include "tag_profile.h"
+
+/*
+ * ST SRx memory maps.
+ * All supported parts share the same layout for blocks 0x00-0x0F and the
+ * system block, they only differ in the size of the EEPROM area.
+ */
+const srix_tag_profile srix_profiles[SRIX_PROFILE_COUNT] = {
+        [SRIX_PROFILE_SRIX4K] = {
+                .name = "SRIX4K", .ic_code = 0x03,
+                .eeprom_size = 512, .blocks = 128,
+                .otp_first = 0x00, .otp_last = 0x04,
+                .counter_first = 0x05, .counter_last = 0x06,
+                .lockable_first = 0x07, .lockable_last = 0x0F,
+                .system_block = SRIX_SYSTEM_BLOCK,
+        },
+        [SRIX_PROFILE_SRI4K] = {
+                .name = "SRI4K", .ic_code = 0x07,
+                .eeprom_size = 512, .blocks = 128,
+                .otp_first = 0x00, .otp_last = 0x04,
+                .counter_first = 0x05, .counter_last = 0x06,
+                .lockable_first = 0x07, .lockable_last = 0x0F,
+                .system_block = SRIX_SYSTEM_BLOCK,
+        },
+        [SRIX_PROFILE_SRIX512] = {
+                .name = "SRIX512", .ic_code = 0x04,
+                .eeprom_size = 64, .blocks = 16,
+                .otp_first = 0x00, .otp_last = 0x04,
+                .counter_first = 0x05, .counter_last = 0x06,
+                .lockable_first = 0x07, .lockable_last = 0x0F,
+                .system_block = SRIX_SYSTEM_BLOCK,
+        },
+        [SRIX_PROFILE_SRI512] = {
+                .name = "SRI512", .ic_code = 0x06,
+                .eeprom_size = 64, .blocks = 16,
+                .otp_first = 0x00, .otp_last = 0x04,
+                .counter_first = 0x05, .counter_last = 0x06,
+                .lockable_first = 0x07, .lockable_last = 0x0F,
+                .system_block = SRIX_SYSTEM_BLOCK,
+        },
+};
+
+const srix_tag_profile *tag_profile = &srix_profiles[SRIX_PROFILE_SRIX4K];
+bool tag_profile_forced = false;
+
+void set_tag_profile(const srix_tag_profile *profile) {
+    tag_profile = profile;
+    set_eeprom_size(profile->eeprom_size);
+    set_eeprom_blocks_amount(profile->blocks);
+}
+
+void set_tag_profile_forced(bool value) {
+    tag_profile_forced = value;
+}
+
+// uid is the GET_UID response as received, LSB first
+const srix_tag_profile *srix_profile_from_uid(const uint8_t *uid) {
+    uint8_t ic_code = SRIX_UID_IC_CODE(uid);
+    for (unsigned int i = 0; i < SRIX_PROFILE_COUNT; i++) {
+        if (srix_profiles[i].ic_code == ic_code) {
+            return &srix_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+const srix_tag_profile *srix_profile_from_size(size_t size) {
+    for (unsigned int i = 0; i < SRIX_PROFILE_COUNT; i++) {
+        if (srix_profiles[i].eeprom_size == size) {
+            return &srix_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+const srix_tag_profile *srix_profile_by_name(const char *name) {
+    // Keep the historical -t spellings
+    if (strcasecmp(name, "x4k") == 0) return &srix_profiles[SRIX_PROFILE_SRIX4K];
+    if (strcasecmp(name, "512") == 0) return &srix_profiles[SRIX_PROFILE_SRI512];
+
+    for (unsigned int i = 0; i < SRIX_PROFILE_COUNT; i++) {
+        if (strcasecmp(srix_profiles[i].name, name) == 0) {
+            return &srix_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Select the active profile from the UID of the selected tag.
+ * A profile forced with -t is kept, a mismatch only produces a warning.
+ * Returns false if the IC code is unknown.
+ */
+bool detect_tag_profile(const uint8_t *uid) {
+    const srix_tag_profile *detected = srix_profile_from_uid(uid);
+    if (detected == NULL) {
+        lwarning("Unknown IC code %02X, assuming %s.\n", SRIX_UID_IC_CODE(uid), tag_profile->name);
+        return false;
+    }
+
+    if (tag_profile_forced) {
+        if (detected->blocks != tag_profile->blocks) {
+            lwarning("Tag looks like %s but %s was selected with -t.\n", detected->name, tag_profile->name);
+        }
+        return true;
+    }
+
+    lverbose("Detected %s (%u blocks).\n", detected->name, detected->blocks);
+    set_tag_profile(detected);
+    return true;
+}
+
+/*
+ * Whether block can be changed from current to wanted with a plain write.
+ * Resettable OTP bits can only be cleared, counters can only count down
+ * (they are stored LSB first). Lock bits are not checked.
+ */
+bool srix_block_write_allowed(const srix_tag_profile *profile, uint8_t block, const uint8_t *current, const uint8_t *wanted) {
+    if (block >= profile->otp_first && block <= profile->otp_last) {
+        for (int i = 0; i < 4; i++) {
+            if (wanted[i] & ~current[i]) return false;
+        }
+        return true;
+    }
+
+    if (block >= profile->counter_first && block <= profile->counter_last) {
+        uint32_t current_value = current[0] | current[1] << 8u | current[2] << 16u | (uint32_t) current[3] << 24u;
+        uint32_t wanted_value = wanted[0] | wanted[1] << 8u | wanted[2] << 16u | (uint32_t) wanted[3] << 24u;
+        return wanted_value <= current_value;
+    }
+
+    return true;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_TAG_PROFILE_H__
+#define __NFC_SRIX_TAG_PROFILE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Macros */
+#define SRIX_SYSTEM_BLOCK 0xFF
+#define SRIX_UID_IC_CODE(uid) ((uid)[5] >> 2u)
+
+/* Profiles */
+typedef struct {
+    const char *name;
+    uint8_t ic_code;          // 6-bit IC code from the UID
+    uint32_t eeprom_size;     // bytes
+    uint32_t blocks;          // 4-byte blocks
+    uint8_t otp_first;        // resettable OTP bits
+    uint8_t otp_last;
+    uint8_t counter_first;    // count down counters
+    uint8_t counter_last;
+    uint8_t lockable_first;   // blocks covered by OTP_Lock_Reg
+    uint8_t lockable_last;
+    uint8_t system_block;     // CHIP_ID, ST reserved, OTP_Lock_Reg
+} srix_tag_profile;
+
+enum {
+    SRIX_PROFILE_SRIX4K,
+    SRIX_PROFILE_SRI4K,
+    SRIX_PROFILE_SRIX512,
+    SRIX_PROFILE_SRI512,
+    SRIX_PROFILE_COUNT,
+};
+
+extern const srix_tag_profile srix_profiles[SRIX_PROFILE_COUNT];
+extern const srix_tag_profile *tag_profile;
+extern bool tag_profile_forced;
+
+void set_tag_profile(const srix_tag_profile *);
+void set_tag_profile_forced(bool);
+
+/* Lookup */
+const srix_tag_profile *srix_profile_from_uid(const uint8_t *uid);
+const srix_tag_profile *srix_profile_from_size(size_t size);
+const srix_tag_profile *srix_profile_by_name(const char *name);
+
+/* Detection */
+bool detect_tag_profile(const uint8_t *uid);
+
+/* Write rules */
+bool srix_block_write_allowed(const srix_tag_profile *profile, uint8_t block, const uint8_t *current, const uint8_t *wanted);
+
+#endif // __NFC_SRIX_TAG_PROFILE_H__
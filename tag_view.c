@@ -0,0 +1,124 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "tag_profile.h"
+#include "tag_view.h"
+#include "health.h"
+
+void tag_view_init(srix_tag_view *view, nfc_device *reader) {
+    view->reader = reader;
+    view->reads = 0;
+    view->system_loaded = false;
+    memset(view->loaded, 0, sizeof(view->loaded));
+}
+
+// Bytes of block in the view, NULL if the tag has no such block
+static uint8_t *tag_view_slot(srix_tag_view *view, uint8_t block) {
+    if (block == SRIX_SYSTEM_BLOCK) {
+        return view->system;
+    }
+    return block < SRIX4K_EEPROM_BLOCKS ? view->bytes + (block * 4) : NULL;
+}
+
+static bool tag_view_loaded(const srix_tag_view *view, uint8_t block) {
+    if (block == SRIX_SYSTEM_BLOCK) {
+        return view->system_loaded;
+    }
+    return (view->loaded[block / 8] >> (block % 8)) & 1u;
+}
+
+static void tag_view_set_loaded(srix_tag_view *view, uint8_t block, bool loaded) {
+    if (block == SRIX_SYSTEM_BLOCK) {
+        view->system_loaded = loaded;
+    } else if (loaded) {
+        view->loaded[block / 8] |= 1u << (block % 8);
+    } else {
+        view->loaded[block / 8] &= ~(1u << (block % 8));
+    }
+}
+
+/*
+ * Returns the 4 bytes of block, reading it from the tag on first access.
+ * The system block is served too. Returns NULL if the block is out of range
+ * or cannot be read.
+ */
+const uint8_t *tag_view_block(srix_tag_view *view, uint8_t block) {
+    uint8_t *current_block = tag_view_slot(view, block);
+    if (current_block == NULL) {
+        return NULL;
+    }
+    if (tag_view_loaded(view, block)) {
+        return current_block;
+    }
+
+    // A dropped frame is read again before the block counts as unreadable
+    uint8_t block_bytes_read = 0;
+    for (uint32_t attempt = 0; attempt <= TAG_VIEW_READ_RETRIES; attempt++) {
+        if (attempt > 0) {
+            lverbose("Received %d bytes instead of 4, retrying.\n", block_bytes_read);
+            health_mark_retry(health_for_device(view->reader));
+        }
+        block_bytes_read = nfc_srix_read_block(view->reader, current_block, block);
+        view->reads++;
+        if (block_bytes_read == 4) break;
+    }
+
+    // Check for errors
+    if (block_bytes_read != 4) {
+        lverbose("Received %d bytes instead of 4.\n", block_bytes_read);
+        return NULL;
+    }
+
+    tag_view_set_loaded(view, block, true);
+    return current_block;
+}
+
+// Fetch every block of set below blocks, stops at the first failing block
+bool tag_view_load(srix_tag_view *view, const srix_block_set *set, uint32_t blocks) {
+    lverbose("Reading %d blocks...\n", block_set_count(set, blocks));
+    for (uint32_t i = 0; i < blocks; i++) {
+        if (!block_set_has(set, i)) continue;
+
+        if (tag_view_block(view, i) == NULL) {
+            lerror("Error while reading block %d.\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Keep the view in sync after a block was written
+void tag_view_store(srix_tag_view *view, uint8_t block, const uint8_t *data) {
+    uint8_t *current_block = tag_view_slot(view, block);
+    if (current_block == NULL) {
+        return;
+    }
+    memcpy(current_block, data, 4);
+    tag_view_set_loaded(view, block, true);
+}
+
+// Force the next access to read block from the tag again
+void tag_view_invalidate(srix_tag_view *view, uint8_t block) {
+    if (tag_view_slot(view, block) == NULL) {
+        return;
+    }
+    tag_view_set_loaded(view, block, false);
+}
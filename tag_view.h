@@ -0,0 +1,43 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_TAG_VIEW_H__
+#define __NFC_SRIX_TAG_VIEW_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "block_set.h"
+
+/* Macros */
+#define TAG_VIEW_READ_RETRIES 2     // reads of a block after the first failed one
+
+/* Lazy tag view */
+typedef struct {
+    nfc_device *reader;
+    uint8_t bytes[SRIX4K_EEPROM_SIZE];
+    uint8_t loaded[SRIX4K_EEPROM_BLOCKS / 8];
+    uint8_t system[4];          // SRIX_SYSTEM_BLOCK, outside the EEPROM image
+    bool system_loaded;
+    uint32_t reads;
+} srix_tag_view;
+
+void tag_view_init(srix_tag_view *view, nfc_device *reader);
+const uint8_t *tag_view_block(srix_tag_view *view, uint8_t block);
+bool tag_view_load(srix_tag_view *view, const srix_block_set *set, uint32_t blocks);
+void tag_view_store(srix_tag_view *view, uint8_t block, const uint8_t *data);
+void tag_view_invalidate(srix_tag_view *view, uint8_t block);
+
+#endif // __NFC_SRIX_TAG_VIEW_H__
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_TRACE_H__
+#define __NFC_SRIX_TRACE_H__
+
+/*
+ * USDT tracepoints, provider "nfc_srix".
+ * Built in when CMake finds sys/sdt.h (option NFC_SRIX_TRACE), each probe is
+ * a single nop until perf or bpftrace attaches to it. Otherwise they compile
+ * to nothing. The scripts/ directory lists the probes and their arguments.
+ */
+#ifdef NFC_SRIX_TRACE
+#include <sys/sdt.h>
+#define TRACE(name) DTRACE_PROBE(nfc_srix, name)
+#define TRACE1(name, a) DTRACE_PROBE1(nfc_srix, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(nfc_srix, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(nfc_srix, name, a, b, c)
+#else
+#define TRACE(name) do {} while (0)
+#define TRACE1(name, a) do {} while (0)
+#define TRACE2(name, a, b) do {} while (0)
+#define TRACE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif // __NFC_SRIX_TRACE_H__
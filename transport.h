@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_TRANSPORT_H__
+#define __NFC_SRIX_TRANSPORT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Alternative to a libnfc device. While a transport is active SRx commands
+ * sent without an nfc_device go through it.
+ */
+typedef struct {
+    const char *name;
+    bool (*select)(void *ctx, uint8_t *uid);    // blocks until a tag answers, uid is the GET_UID frame
+    bool (*is_present)(void *ctx);
+    int (*transceive)(void *ctx, const uint8_t *tx, size_t tx_size, uint8_t *rx, size_t rx_size);
+    void (*abort)(void *ctx);                   // safe from signal handlers and other threads
+    void (*close)(void *ctx);
+    void *ctx;
+} srix_transport;
+
+extern srix_transport *active_transport;
+
+void set_active_transport(srix_transport *);
+
+#endif // __NFC_SRIX_TRANSPORT_H__
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <nfc/nfc.h>
+#include "logging.h"
+#include "nfc_utils.h"
+#include "tag_profile.h"
+#include "verify.h"
+
+verify_order_mode verify_order = VERIFY_ORDER_WRITTEN;
+double verify_confidence = 0;
+uint32_t verify_min_bad = 1;
+
+static uint8_t custom_order[SRIX4K_EEPROM_BLOCKS];
+static uint32_t custom_order_len = 0;
+
+/*
+ * Accepts "written", "seq", "reverse" or an ordered list of hex blocks and
+ * ranges such as "7F,10-1F" that are checked before every other block.
+ */
+bool parse_verify_order(const char *spec) {
+    if (strcmp(spec, "written") == 0) {
+        verify_order = VERIFY_ORDER_WRITTEN;
+        return true;
+    } else if (strcmp(spec, "seq") == 0) {
+        verify_order = VERIFY_ORDER_SEQUENTIAL;
+        return true;
+    } else if (strcmp(spec, "reverse") == 0) {
+        verify_order = VERIFY_ORDER_REVERSE;
+        return true;
+    }
+
+    bool seen[SRIX4K_EEPROM_BLOCKS] = {};
+    const char *p = spec;
+    custom_order_len = 0;
+    while (*p) {
+        char *end;
+        unsigned long first = strtoul(p, &end, 16);
+        if (end == p || first >= SRIX4K_EEPROM_BLOCKS) return false;
+
+        unsigned long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtoul(p, &end, 16);
+            if (end == p || last >= SRIX4K_EEPROM_BLOCKS || last < first) return false;
+            p = end;
+        }
+
+        for (unsigned long i = first; i <= last; i++) {
+            if (seen[i]) continue;
+            seen[i] = true;
+            custom_order[custom_order_len++] = i;
+        }
+
+        if (*p == ',') {
+            p++;
+            if (*p == '\0') return false;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+
+    verify_order = VERIFY_ORDER_CUSTOM;
+    return true;
+}
+
+// "CONFIDENCE[:MIN_BAD]", e.g. "0.99:4"
+bool parse_verify_sample(const char *spec) {
+    char *end;
+    double confidence = strtod(spec, &end);
+    if (end == spec || confidence <= 0 || confidence >= 1) return false;
+
+    unsigned long bad = 1;
+    if (*end == ':') {
+        const char *p = end + 1;
+        bad = strtoul(p, &end, 10);
+        if (end == p || bad == 0) return false;
+    }
+    if (*end != '\0') return false;
+
+    verify_confidence = confidence;
+    verify_min_bad = bad;
+    return true;
+}
+
+/*
+ * Smallest number of blocks to draw without replacement out of total so that
+ * a tag with at least bad wrong blocks is caught with the given confidence.
+ */
+uint32_t verify_sample_size(uint32_t total, double confidence, uint32_t bad) {
+    if (confidence <= 0 || bad == 0 || bad >= total) {
+        return total;
+    }
+
+    double miss = 1.0;
+    for (uint32_t n = 1; n <= total; n++) {
+        miss *= (double) (total - bad - (n - 1)) / (total - (n - 1));
+        if (miss <= 1.0 - confidence) {
+            return n;
+        }
+    }
+    return total;
+}
+
+static int block_priority(const uint8_t *expected, uint8_t block) {
+    if (block <= tag_profile->counter_last) {
+        return 1;
+    }
+    return eeprom_bytes_to_block(expected, block) != 0xFFFFFFFF ? 0 : 2;
+}
+
+/*
+ * Fill plan with the blocks of set below blocks in verification order.
+ * With --verify-sample only a random subset of the blocks is kept.
+ * Returns the number of planned blocks.
+ */
+uint32_t verify_plan(const uint8_t *expected, const srix_block_set *set, uint32_t blocks, uint8_t *plan) {
+    uint32_t n = 0;
+    bool planned[SRIX4K_EEPROM_BLOCKS] = {};
+
+    if (blocks > SRIX4K_EEPROM_BLOCKS) {
+        blocks = SRIX4K_EEPROM_BLOCKS;
+    }
+
+    switch (verify_order) {
+        case VERIFY_ORDER_CUSTOM:
+            for (uint32_t i = 0; i < custom_order_len; i++) {
+                uint8_t block = custom_order[i];
+                if (block < blocks && block_set_has(set, block)) {
+                    plan[n++] = block;
+                    planned[block] = true;
+                }
+            }
+            // Remaining blocks follow in sequential order
+            // fall through
+        case VERIFY_ORDER_SEQUENTIAL:
+            for (uint32_t i = 0; i < blocks; i++) {
+                if (block_set_has(set, i) && !planned[i]) plan[n++] = i;
+            }
+            break;
+
+        case VERIFY_ORDER_REVERSE:
+            for (uint32_t i = blocks; i-- > 0;) {
+                if (block_set_has(set, i)) plan[n++] = i;
+            }
+            break;
+
+        case VERIFY_ORDER_WRITTEN:
+        default:
+            for (int priority = 0; priority < 3; priority++) {
+                for (uint32_t i = 0; i < blocks; i++) {
+                    if (block_set_has(set, i) && block_priority(expected, i) == priority) plan[n++] = i;
+                }
+            }
+            break;
+    }
+
+    uint32_t samples = verify_sample_size(n, verify_confidence, verify_min_bad);
+    if (samples >= n) {
+        return n;
+    }
+
+    // Draw the sample, then keep it in plan order
+    static unsigned int seed = 0;
+    if (seed == 0) {
+        seed = (unsigned int) (monotonic_ms() * 1000);
+    }
+
+    uint8_t pool[SRIX4K_EEPROM_BLOCKS];
+    bool sampled[SRIX4K_EEPROM_BLOCKS] = {};
+    memcpy(pool, plan, n);
+    for (uint32_t i = 0; i < samples; i++) {
+        uint32_t j = i + rand_r(&seed) % (n - i);
+        uint8_t tmp = pool[i];
+        pool[i] = pool[j];
+        pool[j] = tmp;
+        sampled[pool[i]] = true;
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (sampled[plan[i]]) plan[kept++] = plan[i];
+    }
+    return kept;
+}
+
+// Check planned blocks against expected, stops at the first mismatch
+bool verify_run(srix_tag_view *view, const uint8_t *expected, const uint8_t *plan, uint32_t planned, verify_result *result) {
+    memset(result, 0, sizeof(*result));
+    result->planned = planned;
+
+    bool mismatch = false;
+    double start = monotonic_ms();
+    for (uint32_t i = 0; i < planned; i++) {
+        uint8_t block = plan[i];
+        const uint8_t *current_block = tag_view_block(view, block);
+        result->checked++;
+
+        if (current_block == NULL) {
+            result->read_error = true;
+            result->block = block;
+            break;
+        }
+
+        if (eeprom_block_differs(expected, view->bytes, block)) {
+            result->block = block;
+            result->expected = eeprom_bytes_to_block(expected, block);
+            result->actual = eeprom_bytes_to_block(view->bytes, block);
+            mismatch = true;
+            break;
+        }
+    }
+    result->elapsed_ms = monotonic_ms() - start;
+    result->passed = !result->read_error && !mismatch;
+
+    return result->passed;
+}
+
+void verify_print_result(const char *uid, uint32_t blocks, const verify_result *result) {
+    printf("UID %s: ", uid);
+
+    if (result->read_error) {
+        printf(RED "ERROR" RESET " reading block %02X after %u/%u blocks in %.2f ms\n", result->block, result->checked, result->planned, result->elapsed_ms);
+    } else if (!result->passed) {
+        printf(RED "FAIL" RESET " at block %02X after %u/%u blocks in %.2f ms, expected %08X read %08X\n", result->block, result->checked, result->planned, result->elapsed_ms, result->expected, result->actual);
+    } else if (result->planned < blocks) {
+        printf(GREEN "PASS" RESET ", %u/%u blocks sampled (%.1f%% confidence for >= %u bad blocks) in %.2f ms\n", result->checked, blocks, verify_confidence * 100, verify_min_bad, result->elapsed_ms);
+    } else {
+        printf(GREEN "PASS" RESET ", %u/%u blocks verified in %.2f ms\n", result->checked, blocks, result->elapsed_ms);
+    }
+}
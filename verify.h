@@ -0,0 +1,57 @@
+/*
+ * Copyright 2022 Hassan ABBAS
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __NFC_SRIX_VERIFY_H__
+#define __NFC_SRIX_VERIFY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tag_view.h"
+
+typedef enum {
+    VERIFY_ORDER_WRITTEN,     // programmed blocks, then OTP/counters, then blank blocks
+    VERIFY_ORDER_SEQUENTIAL,
+    VERIFY_ORDER_REVERSE,
+    VERIFY_ORDER_CUSTOM,      // blocks from --verify-order first, then the rest
+} verify_order_mode;
+
+typedef struct {
+    bool passed;
+    bool read_error;
+    uint32_t planned;
+    uint32_t checked;
+    uint8_t block;            // failing block
+    uint32_t expected;
+    uint32_t actual;
+    double elapsed_ms;
+} verify_result;
+
+extern verify_order_mode verify_order;
+extern double verify_confidence;
+extern uint32_t verify_min_bad;
+
+bool parse_verify_order(const char *spec);
+bool parse_verify_sample(const char *spec);
+
+/* Planning */
+uint32_t verify_sample_size(uint32_t total, double confidence, uint32_t bad);
+uint32_t verify_plan(const uint8_t *expected, const srix_block_set *set, uint32_t blocks, uint8_t *plan);
+
+/* Verification */
+bool verify_run(srix_tag_view *view, const uint8_t *expected, const uint8_t *plan, uint32_t planned, verify_result *result);
+void verify_print_result(const char *uid, uint32_t blocks, const verify_result *result);
+
+#endif // __NFC_SRIX_VERIFY_H__